@@ -0,0 +1,55 @@
+// per-call cost of throwing api (addVideo/addAudio) vs error-code api (tryAddVideo/tryAddAudio)
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "build_avi.h"
+
+namespace {
+  const size_t framesCount = 200000;
+  const size_t frameSize = 256;
+  const size_t audioSize = 320; // 20 ms of 8 kHz s16
+
+  BuildAvi::Config makeConfig(const char *filename) {
+    BuildAvi::Config config;
+    config.filename = filename;
+    config.video.mediatype = "video/x-h264,width=320,height=240,framerate=25/1";
+    config.audio.push_back( { BuildAvi::AC_PCM } );
+    return config;
+  }
+
+  template<typename Feed>
+  double measure(const char *filename, Feed feed) {
+    std::vector<uint8_t> frame(frameSize, 0), audio(audioSize, 0);
+    frame[3] = 1; frame[4] = 0x41;
+
+    auto builder = BuildAvi::createAviBuilder(makeConfig(filename));
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < framesCount; ++i)
+      feed(*builder, frame, audio);
+    auto stop = std::chrono::steady_clock::now();
+    builder->close();
+
+    return std::chrono::duration<double, std::nano>(stop - start).count() / (2 * framesCount);
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *filename = argc > 1 ? argv[1] : "/dev/null";
+
+  for(int round = 0; round < 3; ++round) {
+    double throwing = measure(filename, [](BuildAvi::AviBuilder& b, const std::vector<uint8_t>& v, const std::vector<uint8_t>& a) {
+      b.addVideo(v.data(), v.size());
+      b.addAudio(0, a.data(), a.size());
+    });
+
+    double errorCode = measure(filename, [](BuildAvi::AviBuilder& b, const std::vector<uint8_t>& v, const std::vector<uint8_t>& a) {
+      if(b.tryAddVideo(v.data(), v.size()) || b.tryAddAudio(0, a.data(), a.size()))
+        std::abort();
+    });
+
+    std::printf("round %d: throwing api %.1f ns/call, error code api %.1f ns/call\n", round, throwing, errorCode);
+  }
+  return 0;
+}
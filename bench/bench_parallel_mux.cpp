@@ -0,0 +1,121 @@
+// muxParallel vs sequential AviBuilder for every audio codec, outputs must be identical
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "avi_parallel_mux.h"
+#include "build_avi.h"
+
+namespace {
+  const size_t framesCount = 3000;
+  const size_t audioSize = 640; // 40 ms of 8 kHz s16
+  const size_t threadsCount = 4;
+
+  using clock = std::chrono::steady_clock;
+
+  struct Sources {
+    std::vector<std::string> files;
+    std::vector<BuildAvi::MuxPacket> packets;
+  };
+
+  // video with an IDR every 25 frames, sine in audio track 1, noise in track 2
+  Sources makeSources(const std::string& dir) {
+    Sources s;
+    s.files = { dir + "/mux_video.bin", dir + "/mux_audio1.bin", dir + "/mux_audio2.bin" };
+    std::ofstream video(s.files[0], std::ios::binary), audio1(s.files[1], std::ios::binary), audio2(s.files[2], std::ios::binary);
+
+    std::mt19937 rng(1);
+    std::vector<char> frame, audio(audioSize);
+    size_t sample = 0;
+    for(size_t i = 0; i < framesCount; ++i) {
+      frame.resize(1000 + rng() % 40000 + i % 2);
+      for(auto & c : frame)
+        c = static_cast<char>(rng());
+      frame[0] = frame[1] = frame[2] = 0;
+      frame[3] = 1;
+      frame[4] = i % 25 ? 0x41 : 0x65;
+      video.write(frame.data(), frame.size());
+      s.packets.push_back({ 0, frame.size() });
+
+      for(size_t k = 0; k < audioSize; k += 2, ++sample) {
+        int16_t v = static_cast<int16_t>(20000 * std::sin(sample * 0.05));
+        audio[k] = static_cast<char>(v & 0xff);
+        audio[k + 1] = static_cast<char>(v >> 8);
+      }
+      audio1.write(audio.data(), audio.size());
+      s.packets.push_back({ 1, audio.size() });
+
+      for(auto & c : audio)
+        c = static_cast<char>(rng());
+      audio2.write(audio.data(), audio.size());
+      s.packets.push_back({ 2, audio.size() });
+    }
+    return s;
+  }
+
+  void muxSequential(const BuildAvi::Config& config, const Sources& s) {
+    std::vector<std::ifstream> files;
+    for(const auto & f : s.files)
+      files.emplace_back(f, std::ios::binary);
+    auto builder = BuildAvi::createAviBuilder(config);
+    std::vector<char> buffer;
+    for(const auto & p : s.packets) {
+      buffer.resize(p.size);
+      files[p.stream].read(buffer.data(), p.size);
+      if(p.stream == 0)
+        builder->addVideo(buffer.data(), buffer.size());
+      else
+        builder->addAudio(p.stream - 1, buffer.data(), buffer.size());
+    }
+    builder->close();
+  }
+
+  std::vector<char> readFile(const std::string& filename) {
+    std::ifstream f(filename, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+  }
+
+  double ms(clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  }
+}
+
+int main(int argc, char **argv) {
+  const std::string dir = argc > 1 ? argv[1] : ".";
+  const Sources sources = makeSources(dir);
+
+  const struct {
+    BuildAvi::AudioCodec codec;
+    const char *name;
+  } codecs[] = { { BuildAvi::AC_PCM, "pcm" }, { BuildAvi::AC_ALAW, "alaw" }, { BuildAvi::AC_MULAW, "mulaw" } };
+
+  int result = 0;
+  for(const auto & c : codecs) {
+    BuildAvi::Config config;
+    config.video.mediatype = "video/x-h264,width=320,height=240,framerate=25/1,stream-format=(string)byte-stream";
+    config.audio.push_back( { c.codec } );
+    config.audio.push_back( { BuildAvi::AC_PCM } );
+    config.chunkChecksums = true;
+
+    config.filename = dir + "/mux_parallel.avi";
+    auto start = clock::now();
+    BuildAvi::muxParallel(config, sources.files, sources.packets, threadsCount);
+    auto parallel = clock::now();
+
+    config.filename = dir + "/mux_sequential.avi";
+    muxSequential(config, sources);
+    auto sequential = clock::now();
+
+    bool same = readFile(dir + "/mux_parallel.avi") == readFile(dir + "/mux_sequential.avi");
+    std::printf("%s: muxParallel %.1f ms, sequential %.1f ms, output %s\n",
+      c.name, ms(parallel - start), ms(sequential - parallel), same ? "identical" : "DIFFERS");
+    if(!same)
+      result = 1;
+  }
+  return result;
+}
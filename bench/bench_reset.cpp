@@ -0,0 +1,78 @@
+// per-clip setup cost: new builder per clip (createAviBuilder) vs one reused builder (reset)
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "build_avi.h"
+
+namespace {
+  const size_t clipsCount = 20000;
+  const size_t framesPerClip = 10;
+  const size_t frameSize = 256;
+  const size_t audioSize = 1600; // 100 ms of 8 kHz s16
+
+  using clock = std::chrono::steady_clock;
+
+  BuildAvi::Config makeConfig(const char *filename) {
+    BuildAvi::Config config;
+    config.filename = filename;
+    config.video.mediatype = "video/x-h264,width=320,height=240,framerate=10/1,stream-format=(string)byte-stream";
+    config.audio.push_back( { BuildAvi::AC_PCM } );
+    return config;
+  }
+
+  struct Result {
+    double setupNs = 0;
+    double clipNs = 0;
+  };
+
+  template<typename Setup>
+  Result measure(Setup setup) {
+    std::vector<uint8_t> frame(frameSize, 0), audio(audioSize, 0);
+    frame[3] = 1; frame[4] = 0x65;
+
+    clock::duration setupTime{}, totalTime{};
+    for(size_t clip = 0; clip < clipsCount; ++clip) {
+      auto start = clock::now();
+      BuildAvi::AviBuilder& builder = setup();
+      auto ready = clock::now();
+      for(size_t i = 0; i < framesPerClip; ++i) {
+        builder.addVideo(frame.data(), frame.size());
+        builder.addAudio(0, audio.data(), audio.size());
+      }
+      builder.close();
+      auto stop = clock::now();
+      setupTime += ready - start;
+      totalTime += stop - start;
+    }
+
+    Result r;
+    r.setupNs = std::chrono::duration<double, std::nano>(setupTime).count() / clipsCount;
+    r.clipNs = std::chrono::duration<double, std::nano>(totalTime).count() / clipsCount;
+    return r;
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *filename = argc > 1 ? argv[1] : "/dev/null";
+  const BuildAvi::Config config = makeConfig(filename);
+
+  for(int round = 0; round < 3; ++round) {
+    BuildAvi::AviBuilder::Ptr fresh;
+    Result create = measure([&]() -> BuildAvi::AviBuilder& {
+      fresh = BuildAvi::createAviBuilder(config);
+      return *fresh;
+    });
+
+    BuildAvi::AviBuilder::Ptr reused = BuildAvi::createAviBuilder(config);
+    reused->close();
+    Result reset = measure([&]() -> BuildAvi::AviBuilder& {
+      reused->reset(config.filename);
+      return *reused;
+    });
+
+    std::printf("round %d: createAviBuilder setup %.0f ns (clip %.0f ns), reset setup %.0f ns (clip %.0f ns)\n",
+      round, create.setupNs, create.clipNs, reset.setupNs, reset.clipNs);
+  }
+  return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace BuildAvi {
+
+  // Files built with Config::chunkChecksums carry a private top-level "crcs"
+  // chunk after idx1 with CRC-32C of every movi chunk payload.
+
+  struct DamagedChunk {
+    size_t stream = 0;  // as in "00db", "01wb"
+    uint64_t index = 0; // chunk number within the stream (frame number for video)
+    uint64_t offset = 0; // chunk header position in file, as in idx1
+    uint32_t size = 0;
+    bool truncated = false; // chunk lies beyond the end of file
+  };
+
+  struct VerifyResult {
+    bool hasChecksums = false;
+    bool tableDamaged = false; // the crcs chunk itself does not match its own crc
+    uint64_t chunksChecked = 0;
+    std::vector<DamagedChunk> damaged; // in file order
+  };
+
+  // maps the file and re-checks chunks from `threads` workers (0 - all cores)
+  VerifyResult verifyAvi(const std::string& filename, size_t threads = 0);
+} // namespace
@@ -0,0 +1,39 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+namespace BuildAvi {
+
+  // Limit of bytes waiting to be written to disk. One instance may be shared
+  // between builders (Config::Ingest::globalBudget) to cap the whole process.
+  class MemoryBudget {
+  public:
+    using Ptr = std::shared_ptr<MemoryBudget>;
+
+    explicit MemoryBudget(size_t limit)
+      : limit_(limit)
+    {}
+
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    // a request bigger than the whole limit is granted when nothing else is held,
+    // otherwise it would never fit
+    bool tryAcquire(size_t nbytes);
+    void acquire(size_t nbytes); // waits for release()
+    void release(size_t nbytes);
+
+    size_t limit() const { return limit_; }
+    size_t used() const;
+
+  private:
+    const size_t limit_;
+    size_t used_ = 0;
+    mutable std::mutex mutex_;
+    std::condition_variable released_;
+
+    bool fits(size_t nbytes) const { return used_ + nbytes <= limit_ || used_ == 0; }
+  };
+} // namespace
@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "build_avi.h"
+
+namespace BuildAvi {
+
+  struct MuxPacket {
+    size_t stream = 0; // 0 - video, 1 + n - Config::audio[n]
+    size_t size = 0;
+  };
+
+  // Offline re-mux of recorded elementary streams into config.filename.
+  // sources[stream] is a file with the stream payload, read sequentially;
+  // packets go in output order, as they would be passed to addVideo/addAudio.
+  // The layout and idx1 are planned up front, then payload is copied into
+  // disjoint regions of the output by `threads` workers.
+  // Output is identical to feeding the same packets to AviBuilder.
+  void muxParallel(
+    const Config& config, 
+    const std::vector<std::string>& sources, 
+    const std::vector<MuxPacket>& packets, 
+    size_t threads
+    );
+} // namespace
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace BuildAvi {
+
+  // Seek sidecar layout (little-endian, every record is 8-byte aligned, so the
+  // whole file can be mmap`ed and used in place):
+  //
+  //   SeekIndexFileHeader
+  //   SeekIndexStreamHeader[streamCount]
+  //   SeekIndexEntry[...]  // per stream, sorted by pts
+  //
+  // pts is measured in stream ticks: seconds = pts * dwScale / dwRate
+  // (frame number for video, sample number for audio), offset is an absolute
+  // file offset of the chunk header, the same value idx1 keeps.
+
+#pragma pack(push, 1)
+  struct SeekIndexFileHeader {
+    char magic[4] = {'A','V','S','K'};
+    uint32_t version = 1;
+    uint32_t streamCount = 0;
+    uint32_t reserved = 0;
+  };
+
+  struct SeekIndexStreamHeader {
+    uint32_t streamIndex = 0; // stream number in avi, as in "00dc", "01wb"
+    uint32_t dwScale = 0;
+    uint32_t dwRate = 0;
+    uint32_t reserved = 0;
+    uint64_t entryCount = 0;
+    uint64_t entriesOffset = 0; // from the beginning of sidecar
+  };
+
+  struct SeekIndexEntry {
+    uint64_t pts = 0;
+    uint64_t offset = 0;
+    uint32_t size = 0; // payload size, chunk header not included
+    uint32_t flags = 0;
+  };
+#pragma pack(pop)
+
+  enum SeekIndexFlags {
+    SIF_KEYFRAME = 0x00000001,
+  };
+
+  class MappedFile;
+
+  // Read-only view of seek sidecar, lookups are binary searches over mapped file
+  class SeekIndex {
+  public:
+    explicit SeekIndex(const std::string& filename); // maps file
+    SeekIndex(const void *data, size_t nbytes);      // uses caller`s memory, no copy
+    ~SeekIndex();
+
+    SeekIndex(const SeekIndex&) = delete;
+    SeekIndex& operator=(const SeekIndex&) = delete;
+
+    size_t streamCount() const;
+    const SeekIndexStreamHeader& stream(size_t n) const;
+    const SeekIndexEntry* entries(size_t n) const;
+
+    // last entry with pts <= seconds (last keyframe if keyframeOnly),
+    // nullptr if there is no such entry
+    const SeekIndexEntry* find(size_t n, double seconds, bool keyframeOnly = true) const;
+
+  private:
+    std::unique_ptr<MappedFile> file_; // owns data_ when the sidecar is mapped
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+
+    void validate();
+  };
+} // namespace
@@ -1,6 +1,11 @@
 #pragma once 
 #include<vector>
 #include<memory>
+#include<string>
+#include<system_error>
+
+#include "avi_memory_budget.h"
+#include "build_avi_error.hpp"
 
 namespace BuildAvi {
 
@@ -10,6 +15,22 @@ namespace BuildAvi {
 
   enum AudioCodec {
     AC_PCM,
+    AC_ALAW,  // G.711 A-law, encoded from s16 pcm passed to addAudio
+    AC_MULAW, // G.711 mu-law, encoded from s16 pcm passed to addAudio
+  };
+
+  // what to do when a chunk does not fit in memory budget, OP_DROP_* may be
+  // combined with OP_BLOCK or OP_WOULD_BLOCK for the data that is not dropped
+  enum OverloadPolicy {
+    OP_BLOCK = 0x0,       // wait until the writer thread frees memory
+    OP_WOULD_BLOCK = 0x1, // return AE_WOULD_BLOCK, data is not taken, call again later
+    OP_DROP_VIDEO = 0x2,  // non-key frames are replaced with empty chunks up to the next keyframe
+    OP_DROP_AUDIO = 0x4,  // audio is replaced with silence of the same length (in track codec)
+  };
+
+  struct IngestStats {
+    uint64_t droppedVideoFrames = 0;
+    uint64_t silencedAudioBytes = 0;
   };
 
   struct Config {
@@ -22,9 +43,20 @@ namespace BuildAvi {
       AudioCodec codecAudeo = AC_PCM;
     };
 
+    // live ingest: when any budget is set, chunks are written by a background thread
+    // and the bytes waiting for disk are limited; otherwise writes are synchronous
+    struct Ingest {
+      size_t memoryBudget = 0; // bytes, per builder, 0 - unlimited
+      MemoryBudget::Ptr globalBudget; // may be shared between builders
+      int overloadPolicy = OP_BLOCK;
+    };
+
     std::string filename;
+    std::string seekIndexFilename; // optional seek sidecar (see avi_seek_index.h), empty - not written
+    bool chunkChecksums = false; // crc32c of every chunk in private "crcs" chunk (see avi_checksum.h)
     VideoChannel video;
     std::vector<AudioChannel> audio;
+    Ingest ingest;
   };
 
  class AviBuilder {
@@ -44,7 +76,38 @@ namespace BuildAvi {
       size_t nbytes
       ) = 0; 
     virtual void close() = 0; 
+
+    // exception-free versions of the above. The first failure is sticky:
+    // every next call returns the same error without touching the file.
+    virtual std::error_code tryAddAudio(
+      size_t channelIndex, 
+      const void *data, 
+      size_t nbytes
+      ) noexcept = 0; 
+
+    virtual std::error_code tryAddVideo(
+      const void *data, 
+      size_t nbytes
+      ) noexcept = 0; 
+    virtual std::error_code tryClose() noexcept = 0; 
+
+    virtual std::error_code error() const noexcept = 0; 
+    virtual IngestStats ingestStats() const noexcept = 0; 
+
+    // starts a new file with the same config, reusing parsed mediatype,
+    // prepared headers and buffers. Allowed before the first chunk or after close.
+    // Empty seekIndexFilename disables the sidecar for the new file.
+    virtual void reset(
+      const std::string& filename, 
+      const std::string& seekIndexFilename = std::string()
+      ) = 0; 
+    virtual std::error_code tryReset(
+      const std::string& filename, 
+      const std::string& seekIndexFilename = std::string()
+      ) noexcept = 0; 
   };
 
   AviBuilder::Ptr createAviBuilder(const Config&);
+  // returns nullptr and sets ec on failure
+  AviBuilder::Ptr createAviBuilder(const Config&, std::error_code& ec) noexcept;
 } // namespace
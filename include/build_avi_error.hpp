@@ -0,0 +1,33 @@
+#pragma once
+#include <system_error>
+
+namespace BuildAvi {
+
+  // error codes of exception-free api (AviBuilder::try* methods)
+  enum AviError {
+    AE_OK = 0,
+    AE_INVALID_MEDIATYPE,
+    AE_INVALID_CHANNEL,
+    AE_TOO_MANY_CHANNELS,
+    AE_ALREADY_CLOSED,
+    AE_NOT_CLOSED,
+    AE_WOULD_BLOCK, // not sticky, see OP_WOULD_BLOCK
+    AE_NO_FRAMERATE,
+    AE_OUT_OF_MEMORY,
+    AE_IO,
+    AE_NO_WRITER_THREAD, // live ingest writer thread could not be created
+  };
+
+  const std::error_category& aviErrorCategory() noexcept;
+
+  // static string, suitable for AviException
+  const char * aviErrorReason(AviError e) noexcept;
+
+  inline std::error_code make_error_code(AviError e) noexcept {
+    return std::error_code(static_cast<int>(e), aviErrorCategory());
+  }
+}
+
+namespace std {
+  template<> struct is_error_code_enum<BuildAvi::AviError> : true_type {};
+}
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+
+#include "async_writer.h"
+
+namespace BuildAvi {
+
+  namespace {
+    // spares are not counted against budgets, so keep few of them and drop
+    // the ones much bigger than the block they would hold
+    const size_t maxSpares = 8;
+    const size_t spareSlack = 64 * 1024;
+  }
+
+  AsyncWriter::AsyncWriter(std::ofstream& ofstr, MemoryBudget& budget, MemoryBudget::Ptr globalBudget)
+    : ofstr_(ofstr)
+    , budget_(budget)
+    , globalBudget_(globalBudget) {
+  }
+
+  AsyncWriter::~AsyncWriter() {
+    finish();
+  }
+
+  bool AsyncWriter::start() {
+    if(thread_.joinable())
+      return true;
+    stop_ = false;
+    failed_ = false;
+    try {
+      thread_ = std::thread(&AsyncWriter::run, this);
+    }
+    catch(const std::system_error &) {
+      return false;
+    }
+    return true;
+  }
+
+  void AsyncWriter::push(const void *prefix, size_t prefixSize, const void *data, size_t nbytes, uint8_t fill, size_t padding, size_t accounted) {
+    size_t stored = data ? nbytes : 0;
+    Pending p;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if(!spare_.empty()) {
+        p.bytes = std::move(spare_.back());
+        spare_.pop_back();
+      }
+    }
+    if(p.bytes.capacity() > 2 * (prefixSize + stored) + spareSlack)
+      std::vector<uint8_t>().swap(p.bytes); // e.g. keyframe buffer reused for an audio chunk
+
+    p.bytes.resize(prefixSize + stored);
+    if(prefixSize)
+      std::memcpy(p.bytes.data(), prefix, prefixSize);
+    if(stored)
+      std::memcpy(p.bytes.data() + prefixSize, data, stored);
+    p.fill = nbytes - stored;
+    p.fillByte = fill;
+    p.padding = padding;
+    p.accounted = accounted;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(std::move(p));
+    }
+    queued_.notify_one();
+  }
+
+  bool AsyncWriter::finish() {
+    if(thread_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      queued_.notify_one();
+      thread_.join();
+    }
+    return !failed_;
+  }
+
+  void AsyncWriter::run() {
+    uint8_t fillBlock[4096];
+    std::memset(fillBlock, 0, sizeof(fillBlock));
+    uint8_t fillByte = 0;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    for(;;) {
+      queued_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if(queue_.empty())
+        return; // stopped and drained
+
+      Pending p = std::move(queue_.front());
+      queue_.pop_front();
+      lock.unlock();
+
+      // after a failure keep draining, so producers blocked on budget wake up
+      if(!failed_) {
+        ofstr_.write(reinterpret_cast<const std::ofstream::char_type*>(p.bytes.data()), p.bytes.size());
+        if(p.fill && p.fillByte != fillByte) {
+          fillByte = p.fillByte;
+          std::memset(fillBlock, fillByte, sizeof(fillBlock));
+        }
+        for(size_t remain = p.fill; remain; ) {
+          size_t n = std::min(remain, sizeof(fillBlock));
+          ofstr_.write(reinterpret_cast<const std::ofstream::char_type*>(fillBlock), n);
+          remain -= n;
+        }
+        for(size_t i = 0; i < p.padding; ++i)
+          ofstr_.put(0);
+        if(!ofstr_)
+          failed_ = true;
+      }
+      if(p.accounted) {
+        budget_.release(p.accounted);
+        if(globalBudget_)
+          globalBudget_->release(p.accounted);
+      }
+      p.bytes.clear();
+
+      lock.lock();
+      if(spare_.size() < maxSpares)
+        spare_.push_back(std::move(p.bytes));
+    }
+  }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "avi_memory_budget.h"
+
+namespace BuildAvi {
+
+  // writes queued blocks to the stream from background thread, so the caller
+  // never waits for the disk; queued bytes are held against memory budgets
+  class AsyncWriter {
+  public:
+    AsyncWriter(std::ofstream& ofstr, MemoryBudget& budget, MemoryBudget::Ptr globalBudget);
+    ~AsyncWriter();
+
+    bool start(); // false if the thread cannot be created
+
+    // queues prefix, then nbytes of data (fill bytes if data is nullptr), then padding zeros;
+    // fill is not stored, accounted bytes are released to the budgets once the block is on disk
+    void push(const void *prefix, size_t prefixSize, const void *data, size_t nbytes, uint8_t fill, size_t padding, size_t accounted);
+
+    // waits for the queue to drain and stops the thread, false if some write failed
+    bool finish();
+    bool failed() const { return failed_; }
+
+  private:
+    struct Pending {
+      std::vector<uint8_t> bytes;
+      size_t fill = 0; // written after bytes
+      uint8_t fillByte = 0;
+      size_t padding = 0;
+      size_t accounted = 0;
+    };
+
+    std::ofstream& ofstr_;
+    MemoryBudget& budget_;
+    MemoryBudget::Ptr globalBudget_;
+
+    std::mutex mutex_;
+    std::condition_variable queued_;
+    std::deque<Pending> queue_;
+    std::vector<std::vector<uint8_t>> spare_; // written buffers kept for reuse
+    bool stop_ = false;
+    std::atomic<bool> failed_ { false };
+    std::thread thread_;
+
+    void run();
+  };
+} // namespace
@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <cstring>
+
+#include "avi_checksum.h"
+#include "avi_structs.h"
+#include "build_avi_exception.hpp"
+#include "crc32c.h"
+#include "mapped_file.h"
+#include "parallel_runs.h"
+
+namespace BuildAvi {
+
+  namespace {
+    struct CheckTask {
+      const Avi::CHUNK_CHECKSUM *entry = nullptr;
+      size_t stream = 0;
+      uint64_t index = 0;
+    };
+
+    bool fourccIs(const uint8_t *p, const char *fourcc) {
+      return std::memcmp(p, fourcc, 4) == 0;
+    }
+
+    // payload of top-level "crcs" chunk, nullptr if there is none
+    const uint8_t * findChecksums(const MappedFile& file, uint32_t& size) {
+      const uint8_t *data = file.data();
+      if(file.size() < 12 || !fourccIs(data, "RIFF") || !fourccIs(data + 8, "AVI "))
+        throw AviException("not an avi file");
+
+      uint64_t offset = 12;
+      while(offset + sizeof(Avi::CHUNK_HEADER) <= file.size()) {
+        Avi::CHUNK_HEADER ch;
+        std::memcpy(&ch, data + offset, sizeof(ch));
+        if(fourccIs(reinterpret_cast<const uint8_t *>(ch.dwFourCC), "crcs")) {
+          if(offset + sizeof(ch) + ch.dwSize > file.size())
+            return nullptr;
+          size = ch.dwSize;
+          return data + offset + sizeof(ch);
+        }
+        offset += sizeof(ch) + ch.dwSize + ch.dwSize % 2;
+      }
+      return nullptr;
+    }
+  }
+
+  VerifyResult verifyAvi(const std::string& filename, size_t threads) {
+    MappedFile file(filename);
+    VerifyResult result;
+
+    uint32_t tableSize = 0;
+    const uint8_t *table = findChecksums(file, tableSize);
+    if(!table || tableSize < sizeof(Avi::CHECKSUM_TABLE_HEADER))
+      return result;
+
+    Avi::CHECKSUM_TABLE_HEADER header;
+    std::memcpy(&header, table, sizeof(header));
+    if(header.dwVersion != Avi::CHECKSUM_TABLE_HEADER().dwVersion)
+      return result;
+    result.hasChecksums = true;
+
+    // entries are packed structs, read in place
+    const auto *entries = reinterpret_cast<const Avi::CHUNK_CHECKSUM *>(table + sizeof(header));
+    size_t count = std::min<size_t>(header.dwEntries, (tableSize - sizeof(header)) / sizeof(Avi::CHUNK_CHECKSUM));
+    result.tableDamaged = count != header.dwEntries ||
+      crc32c(entries, count * sizeof(Avi::CHUNK_CHECKSUM)) != header.dwEntriesCrc;
+
+    std::vector<CheckTask> tasks(count);
+    std::vector<uint64_t> perStream(100, 0);
+    for(size_t i = 0; i < count; ++i) {
+      const char *fourcc = reinterpret_cast<const char *>(&entries[i].ckid);
+      size_t stream = (fourcc[0] - '0') * 10 + (fourcc[1] - '0');
+      if(stream >= perStream.size())
+        stream = perStream.size() - 1; // damaged ckid, still check the payload
+      tasks[i].entry = &entries[i];
+      tasks[i].stream = stream;
+      tasks[i].index = perStream[stream]++;
+    }
+
+    auto runs = splitRuns(tasks.size(), threads, [&tasks](size_t i) { return tasks[i].entry->dwChunkLength; });
+    std::vector<std::vector<DamagedChunk>> found(runs.size());
+    runParallel(runs, [&file, &tasks, &found](size_t n, const Run& run) {
+      auto & damaged = found[n];
+      for(size_t i = run.begin; i < run.end; ++i) {
+        const auto & e = *tasks[i].entry;
+        DamagedChunk d;
+        d.stream = tasks[i].stream;
+        d.index = tasks[i].index;
+        d.offset = e.dwChunkOffset;
+        d.size = e.dwChunkLength;
+
+        uint64_t payload = uint64_t(e.dwChunkOffset) + sizeof(Avi::CHUNK_HEADER);
+        if(payload + e.dwChunkLength > file.size()) {
+          d.truncated = true;
+          damaged.push_back(d);
+        }
+        else if(crc32c(file.data() + payload, e.dwChunkLength) != e.dwCrc)
+          damaged.push_back(d);
+      }
+    });
+
+    result.chunksChecked = count;
+    for(auto & f : found)
+      result.damaged.insert(result.damaged.end(), f.begin(), f.end());
+    return result;
+  }
+}
@@ -0,0 +1,34 @@
+#include <cassert>
+
+#include "avi_memory_budget.h"
+
+namespace BuildAvi {
+
+  bool MemoryBudget::tryAcquire(size_t nbytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(!fits(nbytes))
+      return false;
+    used_ += nbytes;
+    return true;
+  }
+
+  void MemoryBudget::acquire(size_t nbytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    released_.wait(lock, [this, nbytes] { return fits(nbytes); });
+    used_ += nbytes;
+  }
+
+  void MemoryBudget::release(size_t nbytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      assert(nbytes <= used_);
+      used_ -= nbytes;
+    }
+    released_.notify_all();
+  }
+
+  size_t MemoryBudget::used() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return used_;
+  }
+}
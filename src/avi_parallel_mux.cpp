@@ -0,0 +1,209 @@
+#include <atomic>
+#include <cerrno>
+#include <fstream>
+#include <system_error>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "avi_parallel_mux.h"
+#include "avi_structs.h"
+#include "build_avi_exception.hpp"
+#include "crc32c.h"
+#include "mapped_file.h"
+#include "mux_plan.h"
+#include "parallel_runs.h"
+
+namespace BuildAvi {
+
+#ifdef _WIN32
+
+  // no pwrite/mmap here, just feed the packets to the usual builder
+  void muxParallel(const Config& config, const std::vector<std::string>& sources, const std::vector<MuxPacket>& packets, size_t) {
+    if(sources.size() != 1 + config.audio.size())
+      throw AviException("invalid sources count");
+
+    std::vector<std::ifstream> files;
+    for(const auto & source : sources) {
+      files.emplace_back(source.c_str(), std::ios::binary);
+      if(!files.back())
+        throw AviException("cannot open mux source");
+    }
+
+    auto builder = createAviBuilder(config);
+    std::vector<char> buffer;
+    for(const auto & p : packets) {
+      if(p.stream >= files.size())
+        throw AviException("invalid packet stream");
+      buffer.resize(p.size);
+      if(!files[p.stream].read(buffer.data(), p.size))
+        throw AviException("packet is out of source file");
+      if(p.stream == 0)
+        builder->addVideo(buffer.data(), buffer.size());
+      else
+        builder->addAudio(p.stream - 1, buffer.data(), buffer.size());
+    }
+    builder->close();
+  }
+
+#else
+
+  namespace {
+    struct CopyTask {
+      const MappedFile *source = nullptr; // nullptr if payload is taken from memory
+      uint64_t sourceOffset = 0;
+      const uint8_t *payload = nullptr;
+      uint64_t offset = 0;
+      uint32_t size = 0;
+    };
+
+    bool pwriteAll(int fd, const uint8_t *data, size_t nbytes, uint64_t offset) {
+      for(size_t done = 0; done < nbytes; ) {
+        ssize_t n = ::pwrite(fd, data + done, nbytes - done, offset + done);
+        if(n < 0 && errno == EINTR)
+          continue;
+        if(n <= 0)
+          return false;
+        done += n;
+      }
+      return true;
+    }
+
+    bool preadAll(int fd, uint8_t *data, size_t nbytes, uint64_t offset) {
+      for(size_t done = 0; done < nbytes; ) {
+        ssize_t n = ::pread(fd, data + done, nbytes - done, offset + done);
+        if(n < 0 && errno == EINTR)
+          continue;
+        if(n <= 0)
+          return false;
+        done += n;
+      }
+      return true;
+    }
+
+    // crc is computed from the copied bytes when asked for, so checksums scale with workers too
+    bool copyChunk(int fd, const CopyTask& t, uint32_t *crc) {
+      const uint8_t *data = t.source ? t.source->data() + t.sourceOffset : t.payload;
+      if(crc)
+        *crc = crc32c(data, t.size);
+
+      uint64_t done = 0;
+#ifdef __linux__
+      // lets the kernel copy (or reflink) without bouncing through user space
+      while(t.source && done < t.size) {
+        loff_t in = static_cast<loff_t>(t.sourceOffset + done);
+        loff_t out = static_cast<loff_t>(t.offset + done);
+        ssize_t n = ::copy_file_range(t.source->fd(), &in, fd, &out, t.size - done, 0);
+        if(n > 0) {
+          done += n;
+          continue;
+        }
+        if(n < 0 && errno == EINTR)
+          continue;
+        break; // not supported for these files, fall back to pwrite
+      }
+#endif
+      return pwriteAll(fd, data + done, t.size - done, t.offset + done);
+    }
+
+    // planning builder leaves entry crcs zero, fill them and the table crc in place
+    bool writeChecksums(int fd, uint64_t offset, const std::vector<uint32_t>& crcs) {
+      Avi::CHECKSUM_TABLE_HEADER header;
+      std::vector<Avi::CHUNK_CHECKSUM> entries(crcs.size());
+      uint64_t entriesOffset = offset + sizeof(header);
+      size_t entriesSize = entries.size() * sizeof(Avi::CHUNK_CHECKSUM);
+      if(!preadAll(fd, reinterpret_cast<uint8_t *>(&header), sizeof(header), offset) ||
+        !preadAll(fd, reinterpret_cast<uint8_t *>(entries.data()), entriesSize, entriesOffset) ||
+        header.dwEntries != entries.size())
+        return false;
+
+      for(size_t i = 0; i < entries.size(); ++i)
+        entries[i].dwCrc = crcs[i];
+      header.dwEntriesCrc = crc32c(entries.data(), entriesSize);
+      return pwriteAll(fd, reinterpret_cast<const uint8_t *>(&header), sizeof(header), offset) &&
+        pwriteAll(fd, reinterpret_cast<const uint8_t *>(entries.data()), entriesSize, entriesOffset);
+    }
+  }
+
+  void muxParallel(const Config& config, const std::vector<std::string>& sources, const std::vector<MuxPacket>& packets, size_t threads) {
+    if(sources.size() != 1 + config.audio.size())
+      throw AviException("invalid sources count");
+
+    std::vector<std::unique_ptr<MappedFile>> mapped;
+    for(const auto & source : sources)
+      mapped.push_back(std::make_unique<MappedFile>(source));
+
+    std::vector<uint64_t> cursors(mapped.size(), 0);
+    for(const auto & p : packets) {
+      if(p.stream >= mapped.size())
+        throw AviException("invalid packet stream");
+      if(cursors[p.stream] + p.size > mapped[p.stream]->size())
+        throw AviException("packet is out of source file");
+      cursors[p.stream] += p.size;
+    }
+
+    // pass 1: headers, chunk headers and idx1 are written, payload places are recorded
+    MuxPlan plan;
+    Config planConfig = config;
+    planConfig.ingest = Config::Ingest();
+    auto builder = createPlanningBuilder(planConfig, plan);
+    std::fill(cursors.begin(), cursors.end(), 0);
+    for(const auto & p : packets) {
+      const uint8_t *data = mapped[p.stream]->data() + cursors[p.stream];
+      if(p.stream == 0)
+        builder->addVideo(data, p.size);
+      else
+        builder->addAudio(p.stream - 1, data, p.size);
+      cursors[p.stream] += p.size;
+    }
+    builder->close();
+
+    // every stream payload goes to the file in source order, so chunks consume sources sequentially;
+    // G.711 chunks do not match source bytes and come from the plan
+    std::vector<CopyTask> tasks;
+    tasks.reserve(plan.chunks.size());
+    std::fill(cursors.begin(), cursors.end(), 0);
+    for(const auto & chunk : plan.chunks) {
+      CopyTask t;
+      if(chunk.payload.empty()) {
+        t.source = mapped[chunk.stream].get();
+        t.sourceOffset = cursors[chunk.stream];
+        cursors[chunk.stream] += chunk.size;
+      }
+      else
+        t.payload = chunk.payload.data();
+      t.offset = chunk.offset;
+      t.size = chunk.size;
+      tasks.push_back(t);
+    }
+
+    // pass 2: fill the holes, each worker takes a contiguous run of chunks of about equal size
+    int fd = ::open(config.filename.c_str(), O_RDWR);
+    if(fd < 0)
+      throw AviException("avi file write failed");
+
+    std::atomic<bool> failed { false };
+    std::vector<uint32_t> crcs(plan.checksumsOffset ? tasks.size() : 0); // by chunk index
+    auto runs = splitRuns(tasks.size(), threads, [&tasks](size_t i) { return tasks[i].size; });
+    try {
+      runParallel(runs, [&tasks, &failed, &crcs, fd](size_t, const Run& run) {
+        for(size_t i = run.begin; i < run.end && !failed; ++i)
+          if(!copyChunk(fd, tasks[i], crcs.empty() ? nullptr : &crcs[i]))
+            failed = true;
+      });
+    }
+    catch(const std::system_error &) {
+      ::close(fd);
+      throw AviException("cannot start mux workers");
+    }
+
+    if(!failed && plan.checksumsOffset && !writeChecksums(fd, plan.checksumsOffset, crcs))
+      failed = true;
+    if(::close(fd) != 0 || failed)
+      throw AviException("avi file write failed");
+  }
+
+#endif
+}
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+
+#include "avi_seek_index.h"
+#include "build_avi_exception.hpp"
+#include "mapped_file.h"
+#include "seek_index_writer.h"
+
+namespace BuildAvi {
+
+  void SeekIndexWriter::setTimebase(size_t stream, uint32_t dwScale, uint32_t dwRate) {
+    assert(stream < streams_.size());
+    streams_[stream].dwScale = dwScale;
+    streams_[stream].dwRate = dwRate;
+  }
+
+  void SeekIndexWriter::add(size_t stream, uint64_t pts, uint64_t offset, uint32_t size, bool keyframe) {
+    assert(stream < streams_.size());
+    auto & entries = streams_[stream].entries;
+    assert(entries.empty() || entries.back().pts <= pts); // chunks come in pts order
+    SeekIndexEntry e;
+    e.pts = pts;
+    e.offset = offset;
+    e.size = size;
+    e.flags = keyframe ? SIF_KEYFRAME : 0;
+    entries.push_back(e);
+  }
+
+  bool SeekIndexWriter::write(const std::string& filename) const {
+    std::ofstream ofstr(filename.c_str(), std::ios::binary);
+    if(!ofstr)
+      return false;
+
+    SeekIndexFileHeader fileHeader;
+    fileHeader.streamCount = static_cast<uint32_t>(streams_.size());
+    ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&fileHeader), sizeof(fileHeader));
+
+    uint64_t entriesOffset = sizeof(SeekIndexFileHeader) + streams_.size() * sizeof(SeekIndexStreamHeader);
+    for(size_t i = 0; i < streams_.size(); ++i) {
+      SeekIndexStreamHeader sh;
+      sh.streamIndex = static_cast<uint32_t>(i);
+      sh.dwScale = streams_[i].dwScale;
+      sh.dwRate = streams_[i].dwRate;
+      sh.entryCount = streams_[i].entries.size();
+      sh.entriesOffset = entriesOffset;
+      ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&sh), sizeof(sh));
+      entriesOffset += sh.entryCount * sizeof(SeekIndexEntry);
+    }
+
+    for(const auto & s : streams_)
+      ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(s.entries.data()),
+        s.entries.size() * sizeof(SeekIndexEntry));
+    ofstr.close();
+    return !ofstr.fail();
+  }
+
+  SeekIndex::SeekIndex(const std::string& filename)
+    : file_(std::make_unique<MappedFile>(filename))
+    , data_(file_->data())
+    , size_(file_->size()) {
+    validate();
+  }
+
+  SeekIndex::SeekIndex(const void *data, size_t nbytes)
+    : data_(static_cast<const uint8_t *>(data))
+    , size_(nbytes) {
+    validate();
+  }
+
+  SeekIndex::~SeekIndex() = default;
+
+  void SeekIndex::validate() {
+    if(size_ < sizeof(SeekIndexFileHeader))
+      throw AviException("invalid seek index");
+    const auto & fh = *reinterpret_cast<const SeekIndexFileHeader *>(data_);
+    const SeekIndexFileHeader expected;
+    if(!std::equal(fh.magic, fh.magic + 4, expected.magic) || fh.version != expected.version)
+      throw AviException("invalid seek index");
+    if(size_ < sizeof(SeekIndexFileHeader) + fh.streamCount * sizeof(SeekIndexStreamHeader))
+      throw AviException("invalid seek index");
+    for(size_t i = 0; i < fh.streamCount; ++i) {
+      const auto & sh = stream(i);
+      if(sh.entriesOffset > size_ || sh.entryCount > (size_ - sh.entriesOffset) / sizeof(SeekIndexEntry))
+        throw AviException("invalid seek index");
+    }
+  }
+
+  size_t SeekIndex::streamCount() const {
+    return reinterpret_cast<const SeekIndexFileHeader *>(data_)->streamCount;
+  }
+
+  const SeekIndexStreamHeader& SeekIndex::stream(size_t n) const {
+    return reinterpret_cast<const SeekIndexStreamHeader *>(data_ + sizeof(SeekIndexFileHeader))[n];
+  }
+
+  const SeekIndexEntry* SeekIndex::entries(size_t n) const {
+    return reinterpret_cast<const SeekIndexEntry *>(data_ + stream(n).entriesOffset);
+  }
+
+  const SeekIndexEntry* SeekIndex::find(size_t n, double seconds, bool keyframeOnly) const {
+    if(n >= streamCount())
+      throw AviException("invalid stream index");
+    const auto & sh = stream(n);
+    if(!sh.dwScale || !sh.entryCount || !std::isfinite(seconds) || seconds < 0)
+      return nullptr;
+
+    const SeekIndexEntry *begin = entries(n);
+    const SeekIndexEntry *end = begin + sh.entryCount;
+    // seconds may come from a request, the cast is only defined in range
+    double ticks = seconds * sh.dwRate / sh.dwScale;
+    uint64_t pts = ticks >= static_cast<double>(end[-1].pts) ? end[-1].pts : static_cast<uint64_t>(ticks);
+    const SeekIndexEntry *it = std::upper_bound(begin, end, pts,
+      [](uint64_t v, const SeekIndexEntry& e) { return v < e.pts; });
+
+    while(it != begin) {
+      --it;
+      if(!keyframeOnly || (it->flags & SIF_KEYFRAME))
+        return it;
+    }
+    return nullptr;
+  }
+}
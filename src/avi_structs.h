@@ -13,11 +13,17 @@
 #define   AVIIF_KEYFRAME      0x00000010
 #define   AVIIF_NO_TIME       0x00000100
 
-static inline const char * FCC_TYPE_VIDEO = "vids";
-static inline const char * FCC_TYPE_AUDIO = "auds";
-static inline const char * FCC_HANDLER_H264 = "H264";
-static inline const char * FCC_HANDLER_PCM = "araw"; // TODO: "pcm "?
-static inline const char * BICOMPRESSION_H264 = "H264";
+#define   WAVE_FORMAT_PCM     0x0001
+#define   WAVE_FORMAT_ALAW    0x0006
+#define   WAVE_FORMAT_MULAW   0x0007
+
+inline constexpr const char * FCC_TYPE_VIDEO = "vids";
+inline constexpr const char * FCC_TYPE_AUDIO = "auds";
+inline constexpr const char * FCC_HANDLER_H264 = "H264";
+inline constexpr const char * FCC_HANDLER_PCM = "araw"; // TODO: "pcm "?
+inline constexpr const char * FCC_HANDLER_ALAW = "alaw";
+inline constexpr const char * FCC_HANDLER_MULAW = "ulaw";
+inline constexpr const char * BICOMPRESSION_H264 = "H264";
 
 
 namespace Avi {
@@ -105,8 +111,23 @@ namespace Avi {
     uint32_t dwChunkLength = 0;
   };
 
+  // private "crcs" chunk: header, then one entry per idx1 entry
+  struct CHECKSUM_TABLE_HEADER {
+    uint32_t dwVersion = 1;
+    uint32_t dwEntries = 0;
+    uint32_t dwEntriesCrc = 0; // crc32c of entries
+    uint32_t dwReserved = 0;
+  };
+
+  struct CHUNK_CHECKSUM {
+    uint32_t ckid = 0;
+    uint32_t dwChunkOffset = 0;
+    uint32_t dwChunkLength = 0;
+    uint32_t dwCrc = 0; // crc32c of chunk payload
+  };
+
   struct ODMLExtendedAVIHeader {
-    uint32_t dwTotalFrames;
+    uint32_t dwTotalFrames = 0;
   };
 #pragma pack(pop)    
 }
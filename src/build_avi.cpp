@@ -2,12 +2,18 @@
 #include <fstream>
 #include <sstream>
 #include <list>
+#include <numeric>
 #include <set>
 #include <string>
 
 #include "build_avi.h"
 #include "build_avi_exception.hpp"
+#include "async_writer.h"
 #include "avi_structs.h"
+#include "crc32c.h"
+#include "g711.h"
+#include "mux_plan.h"
+#include "seek_index_writer.h"
 
 namespace BuildAvi {
 
@@ -38,7 +44,7 @@ namespace BuildAvi {
   };
 
   template<typename MediaType>
-  void parseMediaType(const std::string& str, MediaType &mt) {
+  bool parseMediaType(const std::string& str, MediaType &mt) {
     try {
       std::istringstream iss(str);
       std::string token;
@@ -50,13 +56,43 @@ namespace BuildAvi {
           mt.notify(token.substr(0, pos), token.substr(pos + 1));
       } // while
     } // try
-    catch(const std::exception & ex) {
-      ex;
-      throw AviException("invalid mediatype");
+    catch(const std::exception &) {
+      return false;
     }
+    return true;
   }
 
 
+  // true if annex-b h264 access unit contains IDR slice
+  static bool isH264Keyframe(const void *data, size_t nbytes) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    for(size_t i = 0; i + 3 < nbytes; ++i) {
+      if(p[i] != 0 || p[i + 1] != 0 || p[i + 2] != 1) 
+        continue;
+      uint8_t nalType = p[i + 3] & 0x1f;
+      if(nalType == 5)
+        return true;
+      if(nalType == 1) // non-IDR slice, the rest of access unit does not matter
+        return false;
+      i += 2;
+    }
+    return false;
+  }
+
+  // scale/rate reduced to fit 32-bit header fields, exact whenever it fits
+  static void toTimebase(uint64_t scale, uint64_t rate, uint32_t& dwScale, uint32_t& dwRate) {
+    if(uint64_t d = std::gcd(scale, rate)) {
+      scale /= d;
+      rate /= d;
+    }
+    while(scale > UINT32_MAX || rate > UINT32_MAX) {
+      scale >>= 1;
+      rate >>= 1;
+    }
+    dwScale = static_cast<uint32_t>(scale);
+    dwRate = static_cast<uint32_t>(rate);
+  }
+
   struct AviStructureConfig {
     uint32_t dwSuggestedBufferSize = 4096;
   };
@@ -68,6 +104,7 @@ namespace BuildAvi {
     std::set<uint32_t *> sizeFields_;
     void add (uint32_t *pSizeField) { sizeFields_.insert(pSizeField); }
     void remove (uint32_t *pSizeField) { sizeFields_.erase(pSizeField); }
+    void clear () { sizeFields_.clear(); }
     void increase(size_t val) {
       for(auto pField : sizeFields_)
         *pField += static_cast<uint32_t>(val);
@@ -76,12 +113,21 @@ namespace BuildAvi {
 
   class AviBuilderImpl : public AviBuilder {
   public:
-    AviBuilderImpl (const Config& c);
+    AviBuilderImpl (const Config& c, MuxPlan *plan = nullptr);
     ~AviBuilderImpl();
 
     void addAudio(size_t channelIndex, const void *, size_t );
     void addVideo(const void *, size_t );
     void close();
+
+    std::error_code tryAddAudio(size_t channelIndex, const void *, size_t ) noexcept;
+    std::error_code tryAddVideo(const void *, size_t ) noexcept;
+    std::error_code tryClose() noexcept;
+    std::error_code error() const noexcept { return error_; }
+    IngestStats ingestStats() const noexcept { return stats_; }
+
+    void reset(const std::string& filename, const std::string& seekIndexFilename);
+    std::error_code tryReset(const std::string& filename, const std::string& seekIndexFilename) noexcept;
   private:
     Config config_;
     std::ofstream ofstr;
@@ -92,6 +138,13 @@ namespace BuildAvi {
       ST_FINISHED, 
     } status_ = ST_READY;
 
+    std::error_code error_;
+    std::error_code fail(std::error_code ec) noexcept {
+      if(!error_)
+        error_ = ec;
+      return error_;
+    }
+
     using pos_t = std::ofstream::pos_type;
     pos_t pos = 0;
 
@@ -114,15 +167,27 @@ namespace BuildAvi {
     Avi::BITMAPINFOHEADER videoInfoHeader_;
     pos_t videoInfoHeaderPosition_ = 0;
 
-    // audio stream header
-    Avi::LIST_HEADER streamAudioList = { {'L','I','S','T'}, 4 ,{'s','t','r','l'}};
-    pos_t streamAudioListPosition_ = 0;
+    // audio streams headers, caches and chunk ids, one element per Config::audio entry
+    struct AudioTracks {
+      std::vector<Avi::LIST_HEADER> lists;
+      std::vector<pos_t> listPositions;
+
+      std::vector<Avi::AVIStreamHeader> headers; // strh
+      std::vector<pos_t> headerPositions;
+
+      std::vector<Avi::WAVEFORMATEX> infoHeaders; // strf
+      std::vector<pos_t> infoHeaderPositions;
 
-    Avi::AVIStreamHeader streamHeaderAudio_;
-    pos_t streamHeaderAudioPosition_ = 0;
+      std::vector<std::vector<uint8_t>> caches; // encoded
+      std::vector<Avi::CHUNK_HEADER> chunks; // "01wb", "02wb"...
 
-    Avi::WAVEFORMATEX audioInfoHeader_;
-    pos_t audioInfoHeaderPosition_= 0;
+      std::vector<AudioCodec> codecs;
+      std::vector<uint8_t> silence; // byte value of silence in track codec
+      std::vector<int> pendingBytes; // g711: first byte of a sample split between calls, -1 - none
+
+      size_t size() const { return headers.size(); }
+      void resize(size_t n);
+    } audio_;
 
     Avi::LIST_HEADER odmlList = { {'L','I','S','T'}, 4,{'o','d','m','l'} };
     pos_t odmlListPosition_ = 0;
@@ -134,37 +199,78 @@ namespace BuildAvi {
     Avi::LIST_HEADER moviHeader_ = { {'L','I','S','T'}, 4 ,{'m','o','v','i'}};
     pos_t moviHeaderPosition_ = 0;
 
+    // headers as they are before the first chunk, restored by reset()
+    struct HeaderTemplate {
+      Avi::MainAVIHeader mainHeader;
+      Avi::AVIStreamHeader streamHeaderVideo;
+      Avi::BITMAPINFOHEADER videoInfoHeader;
+      std::vector<Avi::AVIStreamHeader> audioHeaders;
+      std::vector<Avi::WAVEFORMATEX> audioInfoHeaders;
+    } headerTemplate_;
+
     std::vector<uint8_t> videoCache_;
-    std::vector<uint8_t> audioCache_;
 
+    void appendAudio(size_t channelIndex, const uint8_t *data, size_t nbytes);
+    void restoreHeaders();
     void writePhonyHeaders();
-    void writeHeaders();
-    void writeBlock(const Avi::CHUNK_HEADER&, const void* , bool saveIndex);
-    void writeBlockSplitted(const Avi::CHUNK_HEADER&, const void* );
+    std::error_code writeHeaders();
+    // data == nullptr writes silence, budgeted chunks release their footprint once on disk
+    void writeBlock(const Avi::CHUNK_HEADER&, const void* , bool saveIndex, uint64_t pts = 0, bool keyframe = true, bool budgeted = false);
+    void writeBlockSplitted(const Avi::CHUNK_HEADER&, const void*, uint64_t pts, uint32_t sampleSize, bool budgeted);
     void writePhony(size_t nbytes);
 
     std::vector<uint8_t> indexes_;
+    std::vector<Avi::CHUNK_CHECKSUM> checksums_;
+    void writeChecksums();
 
     SizeFields sizeFields_;
     VideoMediaType videoMediaType_;
+    SeekIndexWriter seekIndex_;
+
+    // live ingest, writer_ is set only when some budget is configured
+    std::unique_ptr<MemoryBudget> budget_;
+    std::unique_ptr<AsyncWriter> writer_;
+    IngestStats stats_;
+    bool videoDropping_ = false; // non-key frames are dropped up to the next keyframe
+
+    enum Admission {
+      AD_ADMITTED,
+      AD_DROP,
+      AD_WOULD_BLOCK,
+    };
+    Admission admit(size_t nbytes, int dropPolicy);
+    size_t admitted_ = 0; // acquired from budgets, not yet passed to the writer
+    void releaseAdmitted();
+    bool outputFailed() const { return writer_ ? writer_->failed() : !ofstr; }
+
+    MuxPlan *plan_ = nullptr; // planning mode, see createPlanningBuilder
   };
 
-  AviBuilderImpl::~AviBuilderImpl () {
+  static size_t chunkFootprint(size_t nbytes) {
+    return sizeof(Avi::CHUNK_HEADER) + nbytes + nbytes % 2;
   }
 
-  AviBuilderImpl::AviBuilderImpl (const Config& c) 
-    : config_(c) {
-    ofstr.exceptions ( std::ifstream::failbit | std::ifstream::badbit );
-    ofstr.open(config_.filename.c_str(), std::ios::binary);
+  AviBuilderImpl::~AviBuilderImpl () {
+  }
 
-    parseMediaType(config_.video.mediatype, videoMediaType_);
+  AviBuilderImpl::AviBuilderImpl (const Config& c, MuxPlan *plan) 
+    : config_(c)
+    , plan_(plan) {
+    if(!parseMediaType(config_.video.mediatype, videoMediaType_))
+      fail(AE_INVALID_MEDIATYPE);
+    if(config_.audio.size() > 99 - 1)
+      fail(AE_TOO_MANY_CHANNELS);
+    if(error_)
+      return;
+
+    seekIndex_.setStreams(1 + config_.audio.size());
     // mainHeader_.dwMicroSecPerFrame // calculate it at finish
     mainHeader_.dwMaxBytesPerSec = 1024*1024*15; // TODO: calculate
     mainHeader_.dwPaddingGranularity = 0; 
     mainHeader_.dwFlags = AVIF_HASINDEX | AVIF_ISINTERLEAVED; 
     mainHeader_.dwTotalFrames = 0; // will be calculated later
     mainHeader_.dwInitialFrames = 0;  
-    mainHeader_.dwStreams = 2; // / TODO: get it from config
+    mainHeader_.dwStreams = static_cast<uint32_t>(1 + config_.audio.size());
     mainHeader_.dwSuggestedBufferSize = 0;
     mainHeader_.dwWidth = videoMediaType_.width;
     mainHeader_.dwHeight = videoMediaType_.height;
@@ -201,99 +307,353 @@ namespace BuildAvi {
     videoInfoHeader_.biClrImportant = 0; 
 
 
-    std::copy(FCC_TYPE_AUDIO, FCC_TYPE_AUDIO+4,  &streamHeaderAudio_.fccType[0]);
-    std::copy(&FCC_HANDLER_PCM[0], &FCC_HANDLER_PCM[0]+4, &streamHeaderAudio_.fccHandler[0]);    
-    streamHeaderAudio_.dwFlags = 0;
-    streamHeaderAudio_.wPriority = 0;
-    streamHeaderAudio_.wLanguage = 0;
-    streamHeaderAudio_.dwInitialFrames = 0;
-    streamHeaderAudio_.dwScale = 1;
-    streamHeaderAudio_.dwRate = 8000; // TODO: get it from mediatype
-    streamHeaderAudio_.dwStart = 0;
-    streamHeaderAudio_.dwLength = 0; // will be calculated later
-    streamHeaderAudio_.dwSuggestedBufferSize = aviStructureConfig.dwSuggestedBufferSize;
-    streamHeaderAudio_.dwQuality = 0;    
-    streamHeaderAudio_.dwSampleSize = 2; 
-    streamHeaderAudio_.rcFrame.left = 0; 
-    streamHeaderAudio_.rcFrame.top = 0;  
-    streamHeaderAudio_.rcFrame.right = 0;
-    streamHeaderAudio_.rcFrame.bottom = 0;
-
-    audioInfoHeader_.wFormatTag = 1;
-    audioInfoHeader_.nChannels = 1;
-    audioInfoHeader_.nSamplesPerSec = 8000; // TODO: get it from mediatype
-    audioInfoHeader_.nAvgBytesPerSec = 16000; // TODO: get it from mediatype
-    audioInfoHeader_.nBlockAlign = 2;
-    audioInfoHeader_.wBitsPerSample = 16;
-    audioInfoHeader_.cbSize = 0;
+    audio_.resize(config_.audio.size());
+    for(size_t i = 0; i < audio_.size(); ++i) {
+      auto & streamHeaderAudio = audio_.headers[i];
+      std::copy(FCC_TYPE_AUDIO, FCC_TYPE_AUDIO+4,  &streamHeaderAudio.fccType[0]);
+      AudioCodec codec = config_.audio[i].codecAudeo;
+      const char *handler = codec == AC_ALAW ? FCC_HANDLER_ALAW : codec == AC_MULAW ? FCC_HANDLER_MULAW : FCC_HANDLER_PCM;
+      uint16_t bytesPerSample = codec == AC_PCM ? 2 : 1;
+      audio_.codecs[i] = codec;
+      audio_.silence[i] = codec == AC_ALAW ? ALAW_SILENCE : codec == AC_MULAW ? MULAW_SILENCE : 0;
+
+      std::copy(handler, handler+4, &streamHeaderAudio.fccHandler[0]);    
+      streamHeaderAudio.dwFlags = 0;
+      streamHeaderAudio.wPriority = 0;
+      streamHeaderAudio.wLanguage = 0;
+      streamHeaderAudio.dwInitialFrames = 0;
+      streamHeaderAudio.dwScale = 1;
+      streamHeaderAudio.dwRate = 8000; // TODO: get it from mediatype
+      streamHeaderAudio.dwStart = 0;
+      streamHeaderAudio.dwLength = 0; // will be calculated later
+      streamHeaderAudio.dwSuggestedBufferSize = aviStructureConfig.dwSuggestedBufferSize;
+      streamHeaderAudio.dwQuality = 0;    
+      streamHeaderAudio.dwSampleSize = bytesPerSample; 
+      streamHeaderAudio.rcFrame.left = 0; 
+      streamHeaderAudio.rcFrame.top = 0;  
+      streamHeaderAudio.rcFrame.right = 0;
+      streamHeaderAudio.rcFrame.bottom = 0;
+
+      auto & audioInfoHeader = audio_.infoHeaders[i];
+      audioInfoHeader.wFormatTag = codec == AC_ALAW ? WAVE_FORMAT_ALAW : codec == AC_MULAW ? WAVE_FORMAT_MULAW : WAVE_FORMAT_PCM;
+      audioInfoHeader.nChannels = 1;
+      audioInfoHeader.nSamplesPerSec = 8000; // TODO: get it from mediatype
+      audioInfoHeader.nAvgBytesPerSec = 8000 * bytesPerSample; // TODO: get it from mediatype
+      audioInfoHeader.nBlockAlign = bytesPerSample;
+      audioInfoHeader.wBitsPerSample = 8 * bytesPerSample;
+      audioInfoHeader.cbSize = 0;
+    }
+
+    headerTemplate_.mainHeader = mainHeader_;
+    headerTemplate_.streamHeaderVideo = streamHeaderVideo_;
+    headerTemplate_.videoInfoHeader = videoInfoHeader_;
+    headerTemplate_.audioHeaders = audio_.headers;
+    headerTemplate_.audioInfoHeaders = audio_.infoHeaders;
+
+    if(!plan_ && (config_.ingest.memoryBudget || config_.ingest.globalBudget)) {
+      budget_ = std::make_unique<MemoryBudget>(config_.ingest.memoryBudget ? config_.ingest.memoryBudget : SIZE_MAX);
+      writer_ = std::make_unique<AsyncWriter>(ofstr, *budget_, config_.ingest.globalBudget);
+    }
+
+    // stream errors are checked after each operation, see error()
+    ofstr.open(config_.filename.c_str(), std::ios::binary);
+    if(!ofstr)
+      fail(AE_IO);
+    else if(writer_ && !writer_->start())
+      fail(AE_NO_WRITER_THREAD);
+  }
+
+  void AviBuilderImpl::appendAudio(size_t channelIndex, const uint8_t *data, size_t nbytes) {
+    auto & audioCache = audio_.caches[channelIndex];
+    AudioCodec codec = audio_.codecs[channelIndex];
+    if(codec == AC_PCM) {
+      audioCache.insert(audioCache.end(), data, data + nbytes); 
+      return;
+    }
+
+    auto encode = codec == AC_ALAW ? encodeAlaw : encodeMulaw;
+    int & pending = audio_.pendingBytes[channelIndex];
+    if(pending >= 0 && nbytes) {
+      uint8_t sample[2] = { static_cast<uint8_t>(pending), data[0] };
+      uint8_t code = 0;
+      encode(sample, 1, &code);
+      audioCache.push_back(code);
+      pending = -1;
+      ++data;
+      --nbytes;
+    }
+
+    size_t samples = nbytes / 2;
+    size_t at = audioCache.size();
+    audioCache.resize(at + samples);
+    encode(data, samples, audioCache.data() + at);
+    if(nbytes % 2)
+      pending = data[nbytes - 1];
+  }
+
+  void AviBuilderImpl::restoreHeaders() {
+    mainHeader_ = headerTemplate_.mainHeader;
+    streamHeaderVideo_ = headerTemplate_.streamHeaderVideo;
+    videoInfoHeader_ = headerTemplate_.videoInfoHeader;
+    std::copy(headerTemplate_.audioHeaders.begin(), headerTemplate_.audioHeaders.end(), audio_.headers.begin());
+    std::copy(headerTemplate_.audioInfoHeaders.begin(), headerTemplate_.audioInfoHeaders.end(), audio_.infoHeaders.begin());
+
+    riffList.dwSize = 4;
+    headerList.dwSize = 4;
+    streamVideoList.dwSize = 4;
+    for(auto & list : audio_.lists)
+      list.dwSize = 4;
+    odmlList.dwSize = 4;
+    moviHeader_.dwSize = 4;
+  }
+
+  void AviBuilderImpl::AudioTracks::resize(size_t n) {
+    lists.assign(n, { {'L','I','S','T'}, 4 ,{'s','t','r','l'}});
+    listPositions.assign(n, 0);
+    headers.assign(n, Avi::AVIStreamHeader());
+    headerPositions.assign(n, 0);
+    infoHeaders.assign(n, Avi::WAVEFORMATEX());
+    infoHeaderPositions.assign(n, 0);
+    caches.resize(n);
+    codecs.assign(n, AC_PCM);
+    silence.assign(n, 0);
+    pendingBytes.assign(n, -1);
+
+    chunks.resize(n);
+    for(size_t i = 0; i < n; ++i) {
+      size_t stream = i + 1; // stream 0 is video
+      chunks[i] = {{ static_cast<char>('0' + stream / 10), static_cast<char>('0' + stream % 10), 'w', 'b' }, 0 };
+    }
   }
 
   void AviBuilderImpl::addAudio(size_t channelIndex, const void *data, size_t nbytes) {
-    if(channelIndex > config_.audio.size() - 1)
-      throw AviException("invalid audio channel index");
+    if(auto ec = tryAddAudio(channelIndex, data, nbytes))
+      throw AviException(aviErrorReason(static_cast<AviError>(ec.value())));
+  } 
 
-    switch(status_) {
-      case ST_READY:  
-        writePhonyHeaders();
-        status_ = ST_MOVI;
-        addAudio(channelIndex, data, nbytes);
-	break;
-      case ST_MOVI: {
-        audioCache_.insert(
-          audioCache_.end(), 
-          static_cast<const uint8_t*>(data), 
-          static_cast<const uint8_t*>(data)+nbytes
-        ); 
-        if(audioCache_.size() < aviStructureConfig.dwSuggestedBufferSize)
+  void AviBuilderImpl::addVideo(const void *data, size_t nbytes) {
+    if(auto ec = tryAddVideo(data, nbytes))
+      throw AviException(aviErrorReason(static_cast<AviError>(ec.value())));
+  } 
+
+  void AviBuilderImpl::close() {
+    if(auto ec = tryClose())
+      throw AviException(aviErrorReason(static_cast<AviError>(ec.value())));
+  } 
+
+  std::error_code AviBuilderImpl::tryAddAudio(size_t channelIndex, const void *data, size_t nbytes) noexcept {
+    if(error_)
+      return error_;
+    if(channelIndex >= audio_.size())
+      return AE_INVALID_CHANNEL; // caller`s mistake, builder is still usable
+
+    try {
+      switch(status_) {
+        case ST_READY:  
+          writePhonyHeaders();
+          status_ = ST_MOVI;
+          return tryAddAudio(channelIndex, data, nbytes);
+        case ST_MOVI: {
+          auto & audioCache = audio_.caches[channelIndex];
+          auto & streamHeaderAudio = audio_.headers[channelIndex];
+          size_t encodedSize = audio_.codecs[channelIndex] == AC_PCM ? nbytes : 
+            (nbytes + (audio_.pendingBytes[channelIndex] >= 0 ? 1 : 0)) / 2;
+          size_t flushCount = (audioCache.size() + encodedSize) / aviStructureConfig.dwSuggestedBufferSize;
+          Admission admission = AD_ADMITTED;
+          if(writer_ && flushCount) {
+            admission = admit(flushCount * chunkFootprint(aviStructureConfig.dwSuggestedBufferSize), OP_DROP_AUDIO);
+            if(admission == AD_WOULD_BLOCK)
+              return AE_WOULD_BLOCK;
+          }
+          appendAudio(channelIndex, static_cast<const uint8_t*>(data), nbytes);
+          if(audioCache.size() < aviStructureConfig.dwSuggestedBufferSize)
+            break;
+          Avi::CHUNK_HEADER chunk = audio_.chunks[channelIndex];
+          chunk.dwSize = static_cast<uint32_t>(audioCache.size());
+          size_t chunksCount = audioCache.size() / aviStructureConfig.dwSuggestedBufferSize;
+          if(admission == AD_DROP) { // silence keeps dwLength and a/v sync as if the data was written
+            writeBlockSplitted(chunk, nullptr, streamHeaderAudio.dwLength, streamHeaderAudio.dwSampleSize, false);
+            stats_.silencedAudioBytes += chunksCount * aviStructureConfig.dwSuggestedBufferSize;
+          }
+          else
+            writeBlockSplitted(chunk, audioCache.data(), streamHeaderAudio.dwLength, streamHeaderAudio.dwSampleSize, writer_ != nullptr);
+          streamHeaderAudio.dwLength += static_cast<uint32_t>(
+            chunksCount * aviStructureConfig.dwSuggestedBufferSize / streamHeaderAudio.dwSampleSize); // we know it`s integer
+          assert(chunksCount * aviStructureConfig.dwSuggestedBufferSize <= audioCache.size());
+          audioCache.erase(audioCache.begin(), audioCache.begin() + chunksCount * aviStructureConfig.dwSuggestedBufferSize);
           break;
-        Avi::CHUNK_HEADER chunk = {{'0','1','w','b'}, static_cast<uint32_t>(audioCache_.size()) }; // TODO why 00? dc or db?
-        writeBlockSplitted(chunk, audioCache_.data());
-        size_t chunksCount = audioCache_.size() / aviStructureConfig.dwSuggestedBufferSize;
-        streamHeaderAudio_.dwLength += static_cast<uint32_t>(
-          chunksCount * aviStructureConfig.dwSuggestedBufferSize / streamHeaderAudio_.dwSampleSize); // we know it`s integer
-        assert(chunksCount * aviStructureConfig.dwSuggestedBufferSize <= audioCache_.size());
-        audioCache_.erase(audioCache_.begin(), audioCache_.begin() + chunksCount * aviStructureConfig.dwSuggestedBufferSize);
-        break;
+        }
+        case ST_FINISHED:
+          return AE_ALREADY_CLOSED;
+        default:
+          assert(false);
       }
-      case ST_FINISHED:
-        throw AviException("avi file already closed");
-      default:
-        assert(false);
     }
+    catch(const std::bad_alloc &) { // caches and index growth are the only things that can throw here
+      releaseAdmitted();
+      return fail(AE_OUT_OF_MEMORY);
+    }
+    return outputFailed() ? fail(AE_IO) : error_;
   } 
 
-  void AviBuilderImpl::addVideo(const void *data, size_t nbytes) {
-    switch(status_) {
-      case ST_READY:
-        writePhonyHeaders();
-        status_ = ST_MOVI;
-        addVideo(data, nbytes);
-	break;
-      case ST_MOVI: { 
-        mainHeader_.dwTotalFrames ++;
-        streamHeaderVideo_.dwLength ++; 
-        Avi::CHUNK_HEADER chunk = {{'0','0','d','b'}, static_cast<uint32_t>(nbytes) }; // TODO why 00? dc or db?
-        writeBlock(chunk, data, true);
-	break;
+  std::error_code AviBuilderImpl::tryAddVideo(const void *data, size_t nbytes) noexcept {
+    if(error_)
+      return error_;
+
+    try {
+      switch(status_) {
+        case ST_READY:
+          writePhonyHeaders();
+          status_ = ST_MOVI;
+          return tryAddVideo(data, nbytes);
+        case ST_MOVI: { 
+          Avi::CHUNK_HEADER chunk = {{'0','0','d','b'}, static_cast<uint32_t>(nbytes) }; // TODO why 00? dc or db?
+          bool keyframe = isH264Keyframe(data, nbytes);
+          bool drop = false;
+          if(writer_) {
+            if(videoDropping_ && !keyframe) // the rest of gop can`t be decoded anyway
+              drop = true;
+            else switch(admit(chunkFootprint(nbytes), keyframe ? 0 : OP_DROP_VIDEO)) {
+              case AD_DROP: drop = true; break;
+              case AD_WOULD_BLOCK: return AE_WOULD_BLOCK;
+              default: break;
+            }
+            videoDropping_ = drop;
+          }
+          if(drop) { // empty chunk, player repeats previous frame and timing is kept
+            chunk.dwSize = 0;
+            writeBlock(chunk, nullptr, true, streamHeaderVideo_.dwLength, false);
+            stats_.droppedVideoFrames ++;
+          }
+          else
+            writeBlock(chunk, data, true, streamHeaderVideo_.dwLength, keyframe, writer_ != nullptr);
+          mainHeader_.dwTotalFrames ++;
+          streamHeaderVideo_.dwLength ++; 
+          break;
+        }
+        case ST_FINISHED: 
+          return AE_ALREADY_CLOSED;
+        default:
+          assert(false);
       }
-      case ST_FINISHED: 
-        throw AviException("avi file already closed");
-      default:
-        assert(false);
     }
+    catch(const std::bad_alloc &) {
+      releaseAdmitted();
+      return fail(AE_OUT_OF_MEMORY);
+    }
+    return outputFailed() ? fail(AE_IO) : error_;
   } 
 
-  void AviBuilderImpl::close() {
-    sizeFields_.remove(&moviHeader_.dwSize);
+  std::error_code AviBuilderImpl::tryClose() noexcept {
+    if(status_ == ST_FINISHED)
+      return error_ ? error_ : make_error_code(AE_ALREADY_CLOSED);
+    bool empty = status_ == ST_READY;
+    status_ = ST_FINISHED;
+    if(error_) {
+      if(writer_)
+        writer_->finish();
+      ofstr.close();
+      return error_;
+    }
 
-    Avi::CHUNK_HEADER ch = {{'i','d','x','1'}, static_cast<uint32_t>(indexes_.size()) };
-    writeBlock(ch, indexes_.data(), false);
+    try { // the writer copies idx1 and crcs into its queue
+      if(empty) // nothing was added, the file still needs headers and empty movi
+        writePhonyHeaders();
+      sizeFields_.remove(&moviHeader_.dwSize);
+
+      Avi::CHUNK_HEADER ch = {{'i','d','x','1'}, static_cast<uint32_t>(indexes_.size()) };
+      writeBlock(ch, indexes_.data(), false);
+      if(config_.chunkChecksums)
+        writeChecksums();
+    }
+    catch(const std::bad_alloc &) {
+      if(writer_)
+        writer_->finish();
+      ofstr.close();
+      return fail(AE_OUT_OF_MEMORY);
+    }
+    if(writer_ && !writer_->finish()) { // headers below are written in place, queue must be empty
+      ofstr.close();
+      return fail(AE_IO);
+    }
     
-    writeHeaders();
+    if(auto ec = writeHeaders()) {
+      ofstr.close();
+      return fail(ec);
+    }
     ofstr.close();
-    status_ = ST_FINISHED;
+    if(!ofstr)
+      return fail(AE_IO);
+
+    if(!config_.seekIndexFilename.empty()) {
+      uint32_t dwScale = streamHeaderVideo_.dwScale, dwRate = streamHeaderVideo_.dwRate;
+      if(audio_.size() && audio_.headers[0].dwLength && streamHeaderVideo_.dwLength) {
+        // the header keeps whole seconds of duration, frame time is audio duration / frames
+        toTimebase(uint64_t(audio_.headers[0].dwLength) * audio_.headers[0].dwScale,
+          uint64_t(audio_.headers[0].dwRate) * streamHeaderVideo_.dwLength, dwScale, dwRate);
+      }
+      seekIndex_.setTimebase(0, dwScale, dwRate);
+      for(size_t i = 0; i < audio_.size(); ++i)
+        seekIndex_.setTimebase(1 + i, audio_.headers[i].dwScale, audio_.headers[i].dwRate);
+      try {
+        if(!seekIndex_.write(config_.seekIndexFilename))
+          return fail(AE_IO);
+      }
+      catch(const std::bad_alloc &) {
+        return fail(AE_OUT_OF_MEMORY);
+      }
+    }
+    return error_;
   } 
 
+  void AviBuilderImpl::reset(const std::string& filename, const std::string& seekIndexFilename) {
+    if(auto ec = tryReset(filename, seekIndexFilename))
+      throw AviException(aviErrorReason(static_cast<AviError>(ec.value())));
+  }
+
+  std::error_code AviBuilderImpl::tryReset(const std::string& filename, const std::string& seekIndexFilename) noexcept {
+    if(status_ == ST_MOVI)
+      return AE_NOT_CLOSED;
+    if(error_ == AE_INVALID_MEDIATYPE || error_ == AE_TOO_MANY_CHANNELS)
+      return error_; // headers were never set up
+
+    try {
+      // assign() reuses capacity of strings, clear() keeps capacity of caches
+      config_.filename.assign(filename);
+      config_.seekIndexFilename.assign(seekIndexFilename);
+    }
+    catch(const std::bad_alloc &) {
+      return fail(AE_OUT_OF_MEMORY);
+    }
+
+    if(writer_)
+      writer_->finish();
+    if(ofstr.is_open())
+      ofstr.close();
+    restoreHeaders();
+    for(auto & cache : audio_.caches)
+      cache.clear();
+    std::fill(audio_.pendingBytes.begin(), audio_.pendingBytes.end(), -1);
+    videoCache_.clear();
+    indexes_.clear();
+    checksums_.clear();
+    seekIndex_.clear();
+    sizeFields_.clear();
+    pos = 0;
+    status_ = ST_READY;
+    error_.clear();
+    stats_ = IngestStats();
+    videoDropping_ = false;
+
+    ofstr.clear();
+    ofstr.open(config_.filename.c_str(), std::ios::binary);
+    if(!ofstr)
+      return fail(AE_IO);
+    if(writer_ && !writer_->start())
+      return fail(AE_NO_WRITER_THREAD);
+    return error_;
+  }
+
   void AviBuilderImpl::writePhonyHeaders() {
     // actually we rewrite headers later, when all params are known
     writePhony(sizeof(riffList));
@@ -320,18 +680,20 @@ namespace BuildAvi {
         writeBlock( {{'s','t','r','f'}, sizeof(videoInfoHeader_) }, &videoInfoHeader_, false);
         sizeFields_.remove(&streamVideoList.dwSize);
 
-        streamAudioListPosition_ = pos;
-        writePhony(sizeof(streamAudioList));
-        sizeFields_.add(&streamAudioList.dwSize);
+        for(size_t i = 0; i < audio_.size(); ++i) {
+          audio_.listPositions[i] = pos;
+          writePhony(sizeof(audio_.lists[i]));
+          sizeFields_.add(&audio_.lists[i].dwSize);
 
-        streamHeaderAudioPosition_ = pos;
-        streamHeaderAudioPosition_ += sizeof(Avi::CHUNK_HEADER);
-        writeBlock( {{'s','t','r','h'}, sizeof(streamHeaderAudio_) }, &streamHeaderAudio_, false);
+          audio_.headerPositions[i] = pos;
+          audio_.headerPositions[i] += sizeof(Avi::CHUNK_HEADER);
+          writeBlock( {{'s','t','r','h'}, sizeof(audio_.headers[i]) }, &audio_.headers[i], false);
 
-        audioInfoHeaderPosition_ = pos;
-        audioInfoHeaderPosition_ += sizeof(Avi::CHUNK_HEADER);
-        writeBlock( {{'s','t','r','f'}, sizeof(audioInfoHeader_) }, &audioInfoHeader_, false);
-        sizeFields_.remove(&streamAudioList.dwSize);
+          audio_.infoHeaderPositions[i] = pos;
+          audio_.infoHeaderPositions[i] += sizeof(Avi::CHUNK_HEADER);
+          writeBlock( {{'s','t','r','f'}, sizeof(audio_.infoHeaders[i]) }, &audio_.infoHeaders[i], false);
+          sizeFields_.remove(&audio_.lists[i].dwSize);
+        }
 
         odmlListPosition_ = pos;
         writePhony(sizeof(odmlList));
@@ -349,9 +711,9 @@ namespace BuildAvi {
       sizeFields_.add(&moviHeader_.dwSize);
   }
 
-  void AviBuilderImpl::writeHeaders() {
-    if(streamHeaderAudio_.dwLength) { // calculate from audio
-      double duration = static_cast<double>(streamHeaderAudio_.dwLength) / static_cast<double>(streamHeaderAudio_.dwRate);
+  std::error_code AviBuilderImpl::writeHeaders() {
+    if(audio_.size() && audio_.headers[0].dwLength) { // calculate from first audio track
+      double duration = static_cast<double>(audio_.headers[0].dwLength) / static_cast<double>(audio_.headers[0].dwRate);
       double framerate = duration / static_cast<double>(streamHeaderVideo_.dwLength);
       streamHeaderVideo_.dwRate = streamHeaderVideo_.dwLength;
       streamHeaderVideo_.dwScale = static_cast<uint32_t>(duration); 
@@ -359,7 +721,7 @@ namespace BuildAvi {
     }
     else { // get from mediatype
       if(!videoMediaType_.frameRateNum)
-        throw AviException("Cannot get framerate from mediatype neither from audio lenght (no audio?)"); 
+        return AE_NO_FRAMERATE;
 
       mainHeader_.dwMicroSecPerFrame = static_cast<uint32_t>(videoMediaType_.frameRateNum ?
         10e5 * videoMediaType_.frameRateDen/ videoMediaType_.frameRateNum : 0); 
@@ -387,44 +749,111 @@ namespace BuildAvi {
     ofstr.seekp(videoInfoHeaderPosition_ );
     ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&videoInfoHeader_), sizeof(videoInfoHeader_));
 
-    ofstr.seekp(streamAudioListPosition_ );
-    ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&streamAudioList), sizeof(streamAudioList));
+    for(size_t i = 0; i < audio_.size(); ++i) {
+      ofstr.seekp(audio_.listPositions[i] );
+      ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&audio_.lists[i]), sizeof(audio_.lists[i]));
 
-    ofstr.seekp(streamHeaderAudioPosition_ );
-    ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&streamHeaderAudio_), sizeof(streamHeaderAudio_));
+      ofstr.seekp(audio_.headerPositions[i] );
+      ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&audio_.headers[i]), sizeof(audio_.headers[i]));
 
-    ofstr.seekp(audioInfoHeaderPosition_ );
-    ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&audioInfoHeader_), sizeof(audioInfoHeader_));
+      ofstr.seekp(audio_.infoHeaderPositions[i] );
+      ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&audio_.infoHeaders[i]), sizeof(audio_.infoHeaders[i]));
+    }
 
     ofstr.seekp(odmlListPosition_ );
     ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&odmlList), sizeof(odmlList));
 
+    odmlHeader_.dwTotalFrames = streamHeaderVideo_.dwLength;
     ofstr.seekp(odmlHeaderPosition_ );
-    ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&odmlHeader_), sizeof(&odmlHeader_));
+    ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&odmlHeader_), sizeof(odmlHeader_));
 
     ofstr.seekp(moviHeaderPosition_ );
     ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&moviHeader_), sizeof(moviHeader_));
+    return {};
   }
 
-  void AviBuilderImpl::writeBlockSplitted(const Avi::CHUNK_HEADER& c, const void* data){
+  AviBuilderImpl::Admission AviBuilderImpl::admit(size_t nbytes, int dropPolicy) {
+    const auto & global = config_.ingest.globalBudget;
+    if(budget_->tryAcquire(nbytes)) {
+      if(!global || global->tryAcquire(nbytes)) {
+        admitted_ += nbytes;
+        return AD_ADMITTED;
+      }
+      budget_->release(nbytes);
+    }
+
+    int policy = config_.ingest.overloadPolicy;
+    if(policy & dropPolicy)
+      return AD_DROP;
+    if(policy & OP_WOULD_BLOCK)
+      return AD_WOULD_BLOCK;
+
+    budget_->acquire(nbytes);
+    if(global)
+      global->acquire(nbytes);
+    admitted_ += nbytes;
+    return AD_ADMITTED;
+  }
+
+  // the writer releases bytes it was given, the rest is returned here when adding fails
+  void AviBuilderImpl::releaseAdmitted() {
+    if(!admitted_)
+      return;
+    budget_->release(admitted_);
+    if(config_.ingest.globalBudget)
+      config_.ingest.globalBudget->release(admitted_);
+    admitted_ = 0;
+  }
+
+  void AviBuilderImpl::writeBlockSplitted(const Avi::CHUNK_HEADER& c, const void* data, uint64_t pts, uint32_t sampleSize, bool budgeted){
     Avi::CHUNK_HEADER ch = c;
     size_t remain = ch.dwSize;
     const std::ofstream::char_type* position = reinterpret_cast<const std::ofstream::char_type*>(data);
 
     while(remain >= aviStructureConfig.dwSuggestedBufferSize) {
       ch.dwSize = aviStructureConfig.dwSuggestedBufferSize;
-      writeBlock(ch, position, true);
+      writeBlock(ch, position, true, pts, true, budgeted);
+      pts += ch.dwSize / sampleSize;
 
       remain -= ch.dwSize;
-      position += ch.dwSize;
+      if(position)
+        position += ch.dwSize;
     }
   }
 
-  void AviBuilderImpl::writeBlock(const Avi::CHUNK_HEADER& ch, const void* data, bool saveIndex){
-    ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&ch), sizeof(ch));
-    ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(data), ch.dwSize);
-    if(ch.dwSize % 2) {
-      ofstr << (char)0;
+  void AviBuilderImpl::writeBlock(const Avi::CHUNK_HEADER& ch, const void* data, bool saveIndex, uint64_t pts, bool keyframe, bool budgeted){
+    size_t stream = (ch.dwFourCC[0] - '0') * 10 + (ch.dwFourCC[1] - '0'); // meaningful for movi chunks only
+    if(plan_ && saveIndex) { // payload is copied later, leave a hole for it
+      ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&ch), sizeof(ch));
+      PlannedChunk planned;
+      planned.stream = stream;
+      planned.offset = static_cast<uint64_t>(pos) + sizeof(ch);
+      planned.size = ch.dwSize;
+      if(stream && audio_.codecs[stream - 1] != AC_PCM) { // encoded here, source holds s16 samples
+        if(data)
+          planned.payload.assign(static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + ch.dwSize);
+        else
+          planned.payload.assign(ch.dwSize, audio_.silence[stream - 1]);
+      }
+      plan_->chunks.push_back(std::move(planned));
+      ofstr.seekp(ch.dwSize + ch.dwSize % 2, std::ios::cur);
+    }
+    else if(writer_) {
+      uint8_t fill = saveIndex && stream ? audio_.silence[stream - 1] : 0;
+      size_t accounted = budgeted ? chunkFootprint(ch.dwSize) : 0;
+      writer_->push(&ch, sizeof(ch), data, ch.dwSize, fill, ch.dwSize % 2, accounted);
+      assert(accounted <= admitted_);
+      admitted_ -= accounted;
+    }
+    else {
+      ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(&ch), sizeof(ch));
+      if(data)
+        ofstr.write(reinterpret_cast<const std::ofstream::char_type*>(data), ch.dwSize);
+      else
+        ofstr << std::string(ch.dwSize, saveIndex && stream ? audio_.silence[stream - 1] : 0);
+      if(ch.dwSize % 2) {
+        ofstr << (char)0;
+      }
     }
 
     if(saveIndex) {
@@ -437,6 +866,20 @@ namespace BuildAvi {
       indexes_.insert(indexes_.end(), 
         reinterpret_cast<const uint8_t *>(&index), 
         reinterpret_cast<const uint8_t *>(&index) + sizeof(index));
+
+      if(config_.chunkChecksums) {
+        Avi::CHUNK_CHECKSUM checksum;
+        checksum.ckid = index.ckid;
+        checksum.dwChunkOffset = index.dwChunkOffset;
+        checksum.dwChunkLength = index.dwChunkLength;
+        if(!plan_) // planned payload is checksummed where it is copied
+          checksum.dwCrc = data ? crc32c(data, ch.dwSize) : crc32cFill(stream ? audio_.silence[stream - 1] : 0, ch.dwSize);
+        checksums_.push_back(checksum);
+      }
+
+      if(!config_.seekIndexFilename.empty()) {
+        seekIndex_.add(stream, pts, static_cast<uint64_t>(pos), ch.dwSize, keyframe);
+      }
     }
 
     sizeFields_.increase(ch.dwSize + sizeof(ch));
@@ -447,13 +890,56 @@ namespace BuildAvi {
     }
   }
 
+  void AviBuilderImpl::writeChecksums() {
+    Avi::CHECKSUM_TABLE_HEADER header;
+    header.dwEntries = static_cast<uint32_t>(checksums_.size());
+    header.dwEntriesCrc = crc32c(checksums_.data(), checksums_.size() * sizeof(Avi::CHUNK_CHECKSUM));
+
+    std::vector<uint8_t> table(sizeof(header) + checksums_.size() * sizeof(Avi::CHUNK_CHECKSUM));
+    std::copy(reinterpret_cast<const uint8_t *>(&header), reinterpret_cast<const uint8_t *>(&header) + sizeof(header), table.begin());
+    if(!checksums_.empty())
+      std::copy(reinterpret_cast<const uint8_t *>(checksums_.data()), 
+        reinterpret_cast<const uint8_t *>(checksums_.data()) + checksums_.size() * sizeof(Avi::CHUNK_CHECKSUM), 
+        table.begin() + sizeof(header));
+
+    Avi::CHUNK_HEADER ch = {{'c','r','c','s'}, static_cast<uint32_t>(table.size()) };
+    if(plan_)
+      plan_->checksumsOffset = static_cast<uint64_t>(pos) + sizeof(ch);
+    writeBlock(ch, table.data(), false);
+  }
+
   void AviBuilderImpl::writePhony(size_t nbytes) {
-    ofstr << std::string(nbytes, 0);
+    if(writer_)
+      writer_->push(nullptr, 0, nullptr, nbytes, 0, 0, 0);
+    else
+      ofstr << std::string(nbytes, 0);
     sizeFields_.increase(nbytes);
     pos += nbytes;
   }
 
   AviBuilder::Ptr createAviBuilder(const Config& c) {
-    return AviBuilder::Ptr(new AviBuilderImpl(c));
+    auto builder = std::make_shared<AviBuilderImpl>(c);
+    if(auto ec = builder->error())
+      throw AviException(aviErrorReason(static_cast<AviError>(ec.value())));
+    return builder;
+  }
+
+  AviBuilder::Ptr createPlanningBuilder(const Config& c, MuxPlan& plan) {
+    auto builder = std::make_shared<AviBuilderImpl>(c, &plan);
+    if(auto ec = builder->error())
+      throw AviException(aviErrorReason(static_cast<AviError>(ec.value())));
+    return builder;
+  }
+
+  AviBuilder::Ptr createAviBuilder(const Config& c, std::error_code& ec) noexcept {
+    try {
+      auto builder = std::make_shared<AviBuilderImpl>(c);
+      ec = builder->error();
+      return ec ? nullptr : builder;
+    }
+    catch(const std::bad_alloc &) {
+      ec = AE_OUT_OF_MEMORY;
+      return nullptr;
+    }
   }
 }
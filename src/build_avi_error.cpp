@@ -0,0 +1,39 @@
+#include <string>
+
+#include "build_avi_error.hpp"
+
+namespace BuildAvi {
+
+  const char * aviErrorReason(AviError e) noexcept {
+    switch(e) {
+      case AE_OK:                return "success";
+      case AE_INVALID_MEDIATYPE: return "invalid mediatype";
+      case AE_INVALID_CHANNEL:   return "invalid audio channel index";
+      case AE_TOO_MANY_CHANNELS: return "too many audio channels";
+      case AE_ALREADY_CLOSED:    return "avi file already closed";
+      case AE_NOT_CLOSED:        return "avi file is not closed yet";
+      case AE_WOULD_BLOCK:       return "memory budget exceeded";
+      case AE_NO_FRAMERATE:      return "Cannot get framerate from mediatype neither from audio lenght (no audio?)";
+      case AE_OUT_OF_MEMORY:     return "out of memory";
+      case AE_IO:                return "avi file write failed";
+      case AE_NO_WRITER_THREAD:  return "cannot start writer thread";
+    }
+    return "unknown error";
+  }
+
+  class AviErrorCategory : public std::error_category {
+  public:
+    const char* name() const noexcept override {
+      return "build_avi";
+    }
+
+    std::string message(int ev) const override {
+      return aviErrorReason(static_cast<AviError>(ev));
+    }
+  };
+
+  const std::error_category& aviErrorCategory() noexcept {
+    static const AviErrorCategory category;
+    return category;
+  }
+}
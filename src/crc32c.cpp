@@ -0,0 +1,163 @@
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define BUILD_AVI_CRC32C_SSE42
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <nmmintrin.h>
+#endif
+
+#include "crc32c.h"
+
+namespace BuildAvi {
+
+  namespace {
+    const uint32_t POLY = 0x82F63B78; // reflected Castagnoli
+
+    // slicing-by-8 tables
+    struct Tables {
+      uint32_t t[8][256];
+
+      Tables() {
+        for(uint32_t i = 0; i < 256; ++i) {
+          uint32_t c = i;
+          for(int k = 0; k < 8; ++k)
+            c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+          t[0][i] = c;
+        }
+        for(uint32_t i = 0; i < 256; ++i)
+          for(int s = 1; s < 8; ++s)
+            t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+      }
+    };
+
+    const Tables& tables() {
+      static const Tables tables;
+      return tables;
+    }
+
+    uint32_t crcTable(const uint8_t *p, size_t n, uint32_t crc) {
+      const auto & t = tables().t;
+      while(n >= 8) {
+        uint32_t lo, hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        p += 8;
+        n -= 8;
+      }
+      while(n--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+      return crc;
+    }
+
+#ifdef BUILD_AVI_CRC32C_SSE42
+    // crc32 instruction has latency 3 and throughput 1, so long buffers are
+    // processed as 3 interleaved streams and the results are merged:
+    // crc(A B C) = crc(A) * x^(2*8L) ^ crc(B) * x^(8L) ^ crc(C), all mod P
+    const size_t STREAM_LENGTH = 4096;
+
+    uint32_t multModP(uint32_t a, uint32_t b) { // reflected polynomials
+      uint32_t m = 1u << 31;
+      uint32_t p = 0;
+      for(;;) {
+        if(a & m) {
+          p ^= b;
+          if((a & (m - 1)) == 0)
+            break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+      }
+      return p;
+    }
+
+    uint32_t xPowModP(size_t bits) { // x^bits mod P
+      uint32_t r = 1u << 31; // x^0
+      while(bits--)
+        r = r & 1 ? (r >> 1) ^ POLY : r >> 1;
+      return r;
+    }
+
+    struct StreamShifts {
+      uint32_t one = xPowModP(8 * STREAM_LENGTH);
+      uint32_t two = xPowModP(2 * 8 * STREAM_LENGTH);
+    };
+
+#ifndef _MSC_VER
+    __attribute__((target("sse4.2")))
+#endif
+    uint32_t crcHardware(const uint8_t *p, size_t n, uint32_t crc) {
+      uint64_t c = crc;
+      if(n >= 3 * STREAM_LENGTH) {
+        static const StreamShifts shifts;
+        do {
+          uint64_t c1 = 0, c2 = 0;
+          for(size_t i = 0; i < STREAM_LENGTH; i += 8) {
+            uint64_t v0, v1, v2;
+            std::memcpy(&v0, p + i, 8);
+            std::memcpy(&v1, p + STREAM_LENGTH + i, 8);
+            std::memcpy(&v2, p + 2 * STREAM_LENGTH + i, 8);
+            c = _mm_crc32_u64(c, v0);
+            c1 = _mm_crc32_u64(c1, v1);
+            c2 = _mm_crc32_u64(c2, v2);
+          }
+          c = multModP(shifts.two, static_cast<uint32_t>(c)) ^ multModP(shifts.one, static_cast<uint32_t>(c1)) ^ static_cast<uint32_t>(c2);
+          p += 3 * STREAM_LENGTH;
+          n -= 3 * STREAM_LENGTH;
+        } while(n >= 3 * STREAM_LENGTH);
+      }
+      while(n >= 8) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        n -= 8;
+      }
+      uint32_t c32 = static_cast<uint32_t>(c);
+      while(n--)
+        c32 = _mm_crc32_u8(c32, *p++);
+      return c32;
+    }
+
+    bool hasSse42() {
+#ifdef _MSC_VER
+      int info[4];
+      __cpuid(info, 1);
+      return (info[2] & (1 << 20)) != 0;
+#else
+      return __builtin_cpu_supports("sse4.2");
+#endif
+    }
+#endif
+
+    using CrcFunction = uint32_t (*)(const uint8_t *, size_t, uint32_t);
+
+    CrcFunction pickImplementation() {
+#ifdef BUILD_AVI_CRC32C_SSE42
+      if(hasSse42())
+        return crcHardware;
+#endif
+      return crcTable;
+    }
+  }
+
+  uint32_t crc32c(const void *data, size_t nbytes, uint32_t crc) {
+    static const CrcFunction impl = pickImplementation();
+    return ~impl(static_cast<const uint8_t *>(data), nbytes, ~crc);
+  }
+
+  uint32_t crc32cFill(uint8_t value, size_t nbytes, uint32_t crc) {
+    uint8_t block[4096];
+    std::memset(block, value, sizeof(block));
+    while(nbytes) {
+      size_t n = nbytes < sizeof(block) ? nbytes : sizeof(block);
+      crc = crc32c(block, n, crc);
+      nbytes -= n;
+    }
+    return crc;
+  }
+}
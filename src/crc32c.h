@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace BuildAvi {
+
+  // CRC-32C (Castagnoli), SSE4.2 crc32 instruction when the cpu has it,
+  // table driven otherwise. Pass previous result as crc to continue a stream.
+  uint32_t crc32c(const void *data, size_t nbytes, uint32_t crc = 0);
+
+  // crc of nbytes equal to value, fed through one 4 KB block, no buffer of nbytes is allocated
+  uint32_t crc32cFill(uint8_t value, size_t nbytes, uint32_t crc = 0);
+} // namespace
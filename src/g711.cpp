@@ -0,0 +1,141 @@
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BUILD_AVI_G711_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "g711.h"
+
+namespace BuildAvi {
+
+  // both laws store a sample as sign, 3-bit segment (position of the leading one)
+  // and 4 bits following the leading one, see G.711 tables
+
+  static int leadingOne(int v) {
+    int n = 0;
+    while(v >>= 1)
+      ++n;
+    return n;
+  }
+
+  uint8_t linearToAlaw(int16_t sample) {
+    int v = sample >> 3; // 13 bit
+    uint8_t mask = 0xD5;
+    if(v < 0) {
+      mask = 0x55;
+      v = -v - 1;
+    }
+    int seg = v < 32 ? 0 : leadingOne(v) - 4;
+    int mantissa = (seg ? v >> seg : v >> 1) & 0x0F;
+    return static_cast<uint8_t>(((seg << 4) | mantissa) ^ mask);
+  }
+
+  uint8_t linearToMulaw(int16_t sample) {
+    const int clip = 8159;
+    const int bias = 0x84 >> 2;
+    int v = sample >> 2; // 14 bit
+    uint8_t mask = 0xFF;
+    if(v < 0) {
+      mask = 0x7F;
+      v = -v;
+    }
+    if(v > clip)
+      v = clip;
+    v += bias; // 33..8192, 8192 saturates to the same code as 8191
+    if(v > 8191)
+      v = 8191;
+    int seg = leadingOne(v) - 5;
+    int mantissa = (v >> (seg + 1)) & 0x0F;
+    return static_cast<uint8_t>(((seg << 4) | mantissa) ^ mask);
+  }
+
+#ifdef BUILD_AVI_G711_SSE2
+  // Segment and mantissa come from the float representation of the magnitude:
+  // exponent is the position of the leading one, the top 4 fraction bits are
+  // exactly the bits after it, so no per-lane variable shifts are needed.
+
+  static inline __m128i exponentOf(__m128i v) { // v > 0, 32-bit lanes
+    return _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(_mm_cvtepi32_ps(v)), 23), _mm_set1_epi32(127));
+  }
+
+  static inline __m128i fractionOf(__m128i v) {
+    return _mm_and_si128(_mm_srli_epi32(_mm_castps_si128(_mm_cvtepi32_ps(v)), 19), _mm_set1_epi32(0x0F));
+  }
+
+  static inline __m128i alaw4(__m128i x) { // x: sign-extended samples
+    __m128i v = _mm_srai_epi32(x, 3);
+    __m128i negative = _mm_cmplt_epi32(v, _mm_setzero_si128());
+    v = _mm_xor_si128(v, negative); // -v - 1 for negative
+    __m128i mask = _mm_or_si128(_mm_and_si128(negative, _mm_set1_epi32(0x55)), _mm_andnot_si128(negative, _mm_set1_epi32(0xD5)));
+
+    __m128i small = _mm_cmplt_epi32(v, _mm_set1_epi32(32));
+    __m128i vOne = _mm_or_si128(v, _mm_set1_epi32(1)); // keeps cvt away from zero, result of small lanes is discarded
+    __m128i seg = _mm_sub_epi32(exponentOf(vOne), _mm_set1_epi32(4));
+    __m128i big = _mm_or_si128(_mm_slli_epi32(seg, 4), fractionOf(vOne));
+    __m128i linear = _mm_and_si128(_mm_srli_epi32(v, 1), _mm_set1_epi32(0x0F));
+    __m128i code = _mm_or_si128(_mm_and_si128(small, linear), _mm_andnot_si128(small, big));
+    return _mm_xor_si128(code, mask);
+  }
+
+  static inline __m128i mulaw4(__m128i x) {
+    __m128i v = _mm_srai_epi32(x, 2);
+    __m128i negative = _mm_cmplt_epi32(v, _mm_setzero_si128());
+    v = _mm_sub_epi32(_mm_xor_si128(v, negative), negative); // abs
+    __m128i mask = _mm_or_si128(_mm_and_si128(negative, _mm_set1_epi32(0x7F)), _mm_andnot_si128(negative, _mm_set1_epi32(0xFF)));
+
+    __m128i clipped = _mm_cmpgt_epi32(v, _mm_set1_epi32(8159));
+    v = _mm_or_si128(_mm_and_si128(clipped, _mm_set1_epi32(8159)), _mm_andnot_si128(clipped, v));
+    v = _mm_add_epi32(v, _mm_set1_epi32(0x84 >> 2));
+    __m128i saturated = _mm_cmpgt_epi32(v, _mm_set1_epi32(8191));
+    v = _mm_or_si128(_mm_and_si128(saturated, _mm_set1_epi32(8191)), _mm_andnot_si128(saturated, v));
+
+    __m128i seg = _mm_sub_epi32(exponentOf(v), _mm_set1_epi32(5));
+    __m128i code = _mm_or_si128(_mm_slli_epi32(seg, 4), fractionOf(v));
+    return _mm_xor_si128(code, mask);
+  }
+
+  template<__m128i (*Encode4)(__m128i)>
+  static size_t encode16(const uint8_t *pcm, size_t samples, uint8_t *out) {
+    size_t i = 0;
+    for(; i + 16 <= samples; i += 16) {
+      __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pcm + 2 * i));
+      __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pcm + 2 * i + 16));
+      // sign-extend 16-bit samples to 32 bits
+      __m128i a0 = _mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16);
+      __m128i a1 = _mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16);
+      __m128i b0 = _mm_srai_epi32(_mm_unpacklo_epi16(b, b), 16);
+      __m128i b1 = _mm_srai_epi32(_mm_unpackhi_epi16(b, b), 16);
+      __m128i lo = _mm_packs_epi32(Encode4(a0), Encode4(a1)); // codes are 0..255, packs keep them
+      __m128i hi = _mm_packs_epi32(Encode4(b0), Encode4(b1));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(lo, hi));
+    }
+    return i;
+  }
+#endif
+
+  template<uint8_t (*Encode)(int16_t)>
+  static void encodeTail(const uint8_t *pcm, size_t from, size_t samples, uint8_t *out) {
+    for(size_t i = from; i < samples; ++i) {
+      int16_t s;
+      std::memcpy(&s, pcm + 2 * i, sizeof(s));
+      out[i] = Encode(s);
+    }
+  }
+
+  void encodeAlaw(const uint8_t *pcm, size_t samples, uint8_t *out) {
+    size_t done = 0;
+#ifdef BUILD_AVI_G711_SSE2
+    done = encode16<alaw4>(pcm, samples, out);
+#endif
+    encodeTail<linearToAlaw>(pcm, done, samples, out);
+  }
+
+  void encodeMulaw(const uint8_t *pcm, size_t samples, uint8_t *out) {
+    size_t done = 0;
+#ifdef BUILD_AVI_G711_SSE2
+    done = encode16<mulaw4>(pcm, samples, out);
+#endif
+    encodeTail<linearToMulaw>(pcm, done, samples, out);
+  }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace BuildAvi {
+
+  // ITU-T G.711 encoders, s16 little-endian samples in, one byte per sample out.
+  // Vectorized where SSE2 is available, bit-exact with the scalar versions.
+  uint8_t linearToAlaw(int16_t sample);
+  uint8_t linearToMulaw(int16_t sample);
+
+  void encodeAlaw(const uint8_t *pcm, size_t samples, uint8_t *out);
+  void encodeMulaw(const uint8_t *pcm, size_t samples, uint8_t *out);
+
+  static const uint8_t ALAW_SILENCE = 0xD5;
+  static const uint8_t MULAW_SILENCE = 0xFF;
+} // namespace
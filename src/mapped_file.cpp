@@ -0,0 +1,64 @@
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "build_avi_exception.hpp"
+#include "mapped_file.h"
+
+namespace BuildAvi {
+
+#ifdef _WIN32
+
+  MappedFile::MappedFile(const std::string& filename) {
+    std::ifstream ifstr(filename.c_str(), std::ios::binary | std::ios::ate);
+    if(!ifstr)
+      throw AviException("cannot open file");
+    size_ = static_cast<size_t>(ifstr.tellg());
+    uint8_t *buffer = new uint8_t[size_ ? size_ : 1];
+    ifstr.seekg(0);
+    if(!ifstr.read(reinterpret_cast<char *>(buffer), size_)) {
+      delete [] buffer;
+      throw AviException("cannot read file");
+    }
+    data_ = buffer;
+  }
+
+  MappedFile::~MappedFile() {
+    delete [] data_;
+  }
+
+#else
+
+  MappedFile::MappedFile(const std::string& filename) {
+    fd_ = ::open(filename.c_str(), O_RDONLY);
+    if(fd_ < 0)
+      throw AviException("cannot open file");
+    struct stat st;
+    if(::fstat(fd_, &st) != 0) {
+      ::close(fd_);
+      throw AviException("cannot open file");
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if(!size_)
+      return;
+    void *p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if(p == MAP_FAILED) {
+      ::close(fd_);
+      throw AviException("cannot map file");
+    }
+    data_ = static_cast<const uint8_t *>(p);
+  }
+
+  MappedFile::~MappedFile() {
+    if(data_)
+      ::munmap(const_cast<uint8_t *>(data_), size_);
+    ::close(fd_);
+  }
+
+#endif
+}
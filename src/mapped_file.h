@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace BuildAvi {
+
+  // read-only view of a whole file: mmap on posix, plain read elsewhere
+  class MappedFile {
+  public:
+    explicit MappedFile(const std::string& filename); // throws AviException
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+#ifndef _WIN32
+    int fd() const { return fd_; }
+#endif
+
+  private:
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+#ifndef _WIN32
+    int fd_ = -1;
+#endif
+  };
+} // namespace
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "build_avi.h"
+
+namespace BuildAvi {
+
+  struct PlannedChunk {
+    size_t stream = 0;
+    uint64_t offset = 0; // payload position in output file
+    uint32_t size = 0;
+    std::vector<uint8_t> payload; // G.711 audio is encoded while planning, written from memory
+  };
+
+  struct MuxPlan {
+    std::vector<PlannedChunk> chunks; // in output order, same as idx1 and crcs entries
+    uint64_t checksumsOffset = 0; // crcs payload position, 0 if Config::chunkChecksums is off
+  };
+
+  // builder that writes headers, chunk headers and idx1 but leaves holes
+  // instead of media payload; crcs entries of the holes are left zero,
+  // whoever fills a hole fills its crc (and the table crc) too
+  AviBuilder::Ptr createPlanningBuilder(const Config&, MuxPlan& plan);
+} // namespace
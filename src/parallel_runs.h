@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace BuildAvi {
+
+  // contiguous range [begin, end) of items handled by one worker
+  struct Run {
+    size_t begin = 0;
+    size_t end = 0;
+  };
+
+  // splits items [0, count) into at most `threads` runs (0 - one per core) of about
+  // equal total size, sizeOf(i) is the size of item i; no run is empty
+  template<typename SizeOf>
+  std::vector<Run> splitRuns(size_t count, size_t threads, SizeOf sizeOf) {
+    if(!threads)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+
+    uint64_t totalBytes = 0;
+    for(size_t i = 0; i < count; ++i)
+      totalBytes += sizeOf(i);
+
+    std::vector<Run> runs;
+    size_t begin = 0;
+    uint64_t assigned = 0;
+    for(size_t w = 0; w < threads && begin < count; ++w) {
+      uint64_t target = totalBytes * (w + 1) / threads;
+      size_t end = begin;
+      while(end < count && (assigned < target || end == begin || w + 1 == threads))
+        assigned += sizeOf(end++);
+      runs.push_back({ begin, end });
+      begin = end;
+    }
+    return runs;
+  }
+
+  // calls work(n, runs[n]) for every run on its own thread and waits for all of them
+  template<typename Work>
+  void runParallel(const std::vector<Run>& runs, Work work) {
+    std::vector<std::thread> workers;
+    workers.reserve(runs.size());
+    try {
+      for(size_t n = 0; n < runs.size(); ++n)
+        workers.emplace_back([&work, &runs, n] { work(n, runs[n]); });
+    }
+    catch(...) { // started workers must be joined before the exception leaves
+      for(auto & w : workers)
+        w.join();
+      throw;
+    }
+    for(auto & w : workers)
+      w.join();
+  }
+} // namespace
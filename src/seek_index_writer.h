@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "avi_seek_index.h"
+
+namespace BuildAvi {
+
+  // collects chunk positions while movi is written and dumps them at close
+  class SeekIndexWriter {
+  public:
+    void setStreams(size_t count) { streams_.resize(count); }
+    void clear() { for(auto & s : streams_) s.entries.clear(); } // keeps capacity
+    void setTimebase(size_t stream, uint32_t dwScale, uint32_t dwRate);
+    void add(size_t stream, uint64_t pts, uint64_t offset, uint32_t size, bool keyframe);
+    bool write(const std::string& filename) const;
+
+  private:
+    struct Stream {
+      uint32_t dwScale = 0;
+      uint32_t dwRate = 0;
+      std::vector<SeekIndexEntry> entries;
+    };
+    std::vector<Stream> streams_;
+  };
+} // namespace